@@ -16,12 +16,15 @@ LOCAL_MODULE := dlib
 LOCAL_C_INCLUDES := $(DLIB_DIR)
 LOCAL_EXPORT_C_INCLUDES := $(DLIB_DIR)
 
+# The decoders are only needed for dlib's embedded face detector, used when
+# jniInit gets no detector path
 LOCAL_SRC_FILES += \
-    $(DLIB_DIR)/dlib/threads/threads_kernel_shared.cpp \
     $(DLIB_DIR)/dlib/entropy_decoder/entropy_decoder_kernel_2.cpp \
     $(DLIB_DIR)/dlib/base64/base64_kernel_1.cpp \
+    $(DLIB_DIR)/dlib/threads/threads_kernel_shared.cpp \
     $(DLIB_DIR)/dlib/threads/threads_kernel_1.cpp \
-    $(DLIB_DIR)/dlib/threads/threads_kernel_2.cpp
+    $(DLIB_DIR)/dlib/threads/threads_kernel_2.cpp \
+    $(DLIB_DIR)/dlib/threads/thread_pool_extension.cpp
 
 include $(BUILD_STATIC_LIBRARY)
 
@@ -48,6 +51,16 @@ LOCAL_C_INCLUDES +=  \
 
 LOCAL_SRC_FILES += \
     jni_head_pose_det.cpp \
+    face_detector.cpp \
+    motion_mask.cpp \
+    frame_signature.cpp \
+    face_tracker.cpp \
+    head_model.cpp \
+    pose_renderer.cpp \
+    landmark_pruning.cpp \
+    shape_predictor_data.cpp \
+    compact_shape_predictor.cpp \
+    model_registry.cpp \
     imageutils_jni.cpp \
     common/rgb2yuv.cpp \
     common/yuv2rgb.cpp \
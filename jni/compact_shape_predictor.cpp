@@ -0,0 +1,394 @@
+#include "compact_shape_predictor.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include <dlib/simd.h>
+
+using namespace dlib;
+
+const static char COMPACT_MAGIC[8] = { 'H', 'P', 'E', 'S', 'H', 'A', 'P', 'E' };
+const static uint64_t SECTION_ALIGNMENT = 64;
+
+static uint64_t alignUp(uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+/** a * b into product, or false when it does not fit in 64 bits.
+ */
+static bool multiply(uint64_t a, uint64_t b, uint64_t& product) {
+    if (a != 0 && b > std::numeric_limits<uint64_t>::max() / a) return false;
+    product = a * b;
+    return true;
+}
+
+/** Pads the stream up to offset, then writes a section of values.
+ */
+template <typename T>
+static void writeSection(std::ostream& out, uint64_t& written, uint64_t offset, const std::vector<T>& values) {
+    static const char zeros[SECTION_ALIGNMENT] = {};
+    out.write(zeros, offset - written);
+    out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    written = offset + values.size() * sizeof(T);
+}
+
+/** Integer leaves, value / scale of their level, rounded to the nearest.
+ */
+template <typename T>
+static std::vector<T> quantizeLeaves(const std::vector<float>& leaves, uint32_t num_levels,
+                                     std::vector<float>& scales) {
+    const uint64_t per_level = num_levels == 0 ? 0 : leaves.size() / num_levels;
+    scales.assign(num_levels, 0);
+    std::vector<T> quantized(leaves.size());
+    for (uint32_t level = 0; level < num_levels; level++) {
+        const std::vector<float>::const_iterator first = leaves.begin() + level * per_level;
+        float max_abs = 0;
+        for (std::vector<float>::const_iterator v = first; v != first + per_level; ++v)
+            max_abs = std::max(max_abs, std::abs(*v));
+        scales[level] = max_abs > 0 ? max_abs / std::numeric_limits<T>::max() : 1;
+        for (uint64_t i = 0; i < per_level; i++)
+            quantized[level * per_level + i] = (T) std::floor(first[i] / scales[level] + 0.5f);
+    }
+    return quantized;
+}
+
+/** Integer threshold deciding like thresh for any integer pixel difference,
+ *  all of which lie in [-255, 255].
+ */
+static int16_t quantizeThreshold(float thresh) {
+    return (int16_t) std::max(-256.f, std::min(255.f, std::floor(thresh)));
+}
+
+void writeCompactShapePredictor(const ShapePredictorData& data,
+                                const std::vector<unsigned long>& landmarks, std::ostream& out,
+                                int leaf_bits) {
+    if (leaf_bits != 32 && leaf_bits != 16 && leaf_bits != 8)
+        throw serialization_error("Leaves are 32, 16 or 8 bits.");
+    CompactShapePredictorHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, COMPACT_MAGIC, sizeof(header.magic));
+    header.version = COMPACT_SHAPE_PREDICTOR_VERSION;
+    header.num_parts = data.initial_shape.size() / 2;
+    header.num_levels = data.forests.size();
+    header.num_trees = data.forests.empty() ? 0 : data.forests[0].size();
+    header.num_splits = header.num_trees == 0 ? 0 : data.forests[0][0].splits.size();
+    header.num_features = data.anchor_idx.empty() ? 0 : data.anchor_idx[0].size();
+    header.leaf_bits = leaf_bits;
+    header.thresh_bits = leaf_bits == 32 ? 32 : 16;
+
+    std::vector<uint32_t> parts(header.num_parts);
+    for (uint32_t i = 0; i < header.num_parts; i++) parts[i] = landmarks.empty() ? i : landmarks[i];
+
+    std::vector<float> initial_shape(data.initial_shape.begin(), data.initial_shape.end());
+
+    std::vector<uint32_t> anchors;
+    std::vector<float> deltas;
+    for (uint32_t level = 0; level < header.num_levels; level++) {
+        if (data.anchor_idx[level].size() != header.num_features)
+            throw serialization_error("Cascade levels with different numbers of feature pixels.");
+        for (uint32_t i = 0; i < header.num_features; i++) {
+            anchors.push_back(data.anchor_idx[level][i]);
+            deltas.push_back(data.deltas[level][i].x());
+            deltas.push_back(data.deltas[level][i].y());
+        }
+    }
+
+    std::vector<uint32_t> split_idx1, split_idx2;
+    std::vector<float> split_thresh, leaves;
+    for (const std::vector<impl::regression_tree>& forest : data.forests) {
+        if (forest.size() != header.num_trees)
+            throw serialization_error("Cascade levels with different numbers of trees.");
+        for (const impl::regression_tree& tree : forest) {
+            if (tree.splits.size() != header.num_splits || tree.leaf_values.size() != header.num_splits + 1)
+                throw serialization_error("Regression trees of different depths.");
+            for (const impl::split_feature& split : tree.splits) {
+                split_idx1.push_back(split.idx1);
+                split_idx2.push_back(split.idx2);
+                split_thresh.push_back(split.thresh);
+            }
+            for (const matrix<float,0,1>& leaf : tree.leaf_values)
+                leaves.insert(leaves.end(), leaf.begin(), leaf.end());
+        }
+    }
+
+    std::vector<int16_t> split_thresh16, leaves16;
+    std::vector<int8_t> leaves8;
+    std::vector<float> leaf_scales;
+    if (header.thresh_bits == 16) {
+        for (float thresh : split_thresh) split_thresh16.push_back(quantizeThreshold(thresh));
+    }
+    if (leaf_bits == 16) leaves16 = quantizeLeaves<int16_t>(leaves, header.num_levels, leaf_scales);
+    if (leaf_bits == 8) leaves8 = quantizeLeaves<int8_t>(leaves, header.num_levels, leaf_scales);
+
+    // Lay the sections out one after the other
+    uint64_t offset = alignUp(sizeof(header));
+    header.landmarks_offset = offset;
+    offset = alignUp(offset + parts.size() * sizeof(uint32_t));
+    header.initial_shape_offset = offset;
+    offset = alignUp(offset + initial_shape.size() * sizeof(float));
+    header.anchors_offset = offset;
+    offset = alignUp(offset + anchors.size() * sizeof(uint32_t));
+    header.deltas_offset = offset;
+    offset = alignUp(offset + deltas.size() * sizeof(float));
+    header.split_idx1_offset = offset;
+    offset = alignUp(offset + split_idx1.size() * sizeof(uint32_t));
+    header.split_idx2_offset = offset;
+    offset = alignUp(offset + split_idx2.size() * sizeof(uint32_t));
+    header.split_thresh_offset = offset;
+    offset = alignUp(offset + split_thresh.size() * header.thresh_bits / 8);
+    header.leaf_scales_offset = leaf_scales.empty() ? 0 : offset;
+    offset = alignUp(offset + leaf_scales.size() * sizeof(float));
+    header.leaves_offset = offset;
+    header.size = offset + leaves.size() * leaf_bits / 8;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t written = sizeof(header);
+    writeSection(out, written, header.landmarks_offset, parts);
+    writeSection(out, written, header.initial_shape_offset, initial_shape);
+    writeSection(out, written, header.anchors_offset, anchors);
+    writeSection(out, written, header.deltas_offset, deltas);
+    writeSection(out, written, header.split_idx1_offset, split_idx1);
+    writeSection(out, written, header.split_idx2_offset, split_idx2);
+    if (header.thresh_bits == 16)
+        writeSection(out, written, header.split_thresh_offset, split_thresh16);
+    else
+        writeSection(out, written, header.split_thresh_offset, split_thresh);
+    if (!leaf_scales.empty()) writeSection(out, written, header.leaf_scales_offset, leaf_scales);
+    if (leaf_bits == 16)
+        writeSection(out, written, header.leaves_offset, leaves16);
+    else if (leaf_bits == 8)
+        writeSection(out, written, header.leaves_offset, leaves8);
+    else
+        writeSection(out, written, header.leaves_offset, leaves);
+    if (!out) throw serialization_error("Error writing the compact shape predictor.");
+}
+
+CompactShapePredictor::CompactShapePredictor() :
+    data(0), size(0), header(0), leafBits(32), paddedFeatures(0), referenceSigma(0) {
+}
+
+CompactShapePredictor::~CompactShapePredictor() {
+    unload();
+}
+
+bool CompactShapePredictor::isCompact(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    char magic[sizeof(COMPACT_MAGIC)];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, COMPACT_MAGIC, sizeof(magic)) == 0;
+}
+
+void CompactShapePredictor::load(const std::string& path) {
+    unload();
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw serialization_error("Unable to open " + path + " for reading.");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CompactShapePredictorHeader)) {
+        close(fd);
+        throw serialization_error("Not a compact shape predictor: " + path);
+    }
+    void* mapped = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) throw serialization_error("Unable to map " + path);
+    data = mapped;
+    size = st.st_size;
+    attach(static_cast<const char*>(data), size, path);
+}
+
+void CompactShapePredictor::assign(const ShapePredictorData& model, const std::vector<unsigned long>& landmarks) {
+    unload();
+
+    std::ostringstream out;
+    writeCompactShapePredictor(model, landmarks, out);
+    const std::string laid_out = out.str();
+    buffer.assign(laid_out.begin(), laid_out.end());
+    attach(&buffer[0], buffer.size(), "shape predictor");
+}
+
+void CompactShapePredictor::attach(const char* base, size_t length, const std::string& name) {
+    if (length < sizeof(CompactShapePredictorHeader)) {
+        unload();
+        throw serialization_error("Not a valid compact shape predictor: " + name);
+    }
+
+    // Check everything the predictor will index before trusting the file. The
+    // counts come from the header, so every product is checked for overflow
+    // and every section size is compared by division, never multiplied out.
+    const CompactShapePredictorHeader* h = reinterpret_cast<const CompactShapePredictorHeader*>(base);
+    const uint64_t coords = 2 * (uint64_t) h->num_parts;
+    uint64_t features = 0, level_trees = 0, splits = 0, leaves_per_level = 0, leaf_values = 0;
+    const bool counted = multiply(h->num_levels, h->num_features, features) &&
+                         multiply(h->num_levels, h->num_trees, level_trees) &&
+                         multiply(level_trees, h->num_splits, splits) &&
+                         multiply(level_trees, (uint64_t) h->num_splits + 1, leaves_per_level) &&
+                         multiply(leaves_per_level, coords, leaf_values);
+    // Version 1 files have zeros where the version 2 fields are: float
+    const uint32_t leaf_bits = h->version >= 2 ? h->leaf_bits : 32;
+    const uint32_t thresh_bits = h->version >= 2 ? h->thresh_bits : 32;
+    const bool quantized = leaf_bits != 32;
+    const auto fits = [&](uint64_t offset, uint64_t count, uint64_t bits) {
+        return offset % SECTION_ALIGNMENT == 0 && offset <= length && count <= (length - offset) / (bits / 8);
+    };
+    if (!counted || std::memcmp(h->magic, COMPACT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version == 0 || h->version > COMPACT_SHAPE_PREDICTOR_VERSION || h->size != length || h->num_parts == 0 ||
+        (leaf_bits != 32 && leaf_bits != 16 && leaf_bits != 8) || thresh_bits != (quantized ? 16u : 32u) ||
+        (quantized && !fits(h->leaf_scales_offset, h->num_levels, 32)) ||
+        !fits(h->landmarks_offset, h->num_parts, 32) || !fits(h->initial_shape_offset, coords, 32) ||
+        !fits(h->anchors_offset, features, 32) || !fits(h->deltas_offset, features, 64) ||
+        !fits(h->split_idx1_offset, splits, 32) || !fits(h->split_idx2_offset, splits, 32) ||
+        !fits(h->split_thresh_offset, splits, thresh_bits) || !fits(h->leaves_offset, leaf_values, leaf_bits)) {
+        unload();
+        throw serialization_error("Not a valid compact shape predictor: " + name);
+    }
+
+    landmarks = reinterpret_cast<const uint32_t*>(base + h->landmarks_offset);
+    initial_shape = reinterpret_cast<const float*>(base + h->initial_shape_offset);
+    const uint32_t* anchors = reinterpret_cast<const uint32_t*>(base + h->anchors_offset);
+    const float* deltas = reinterpret_cast<const float*>(base + h->deltas_offset);
+    split_idx1 = reinterpret_cast<const uint32_t*>(base + h->split_idx1_offset);
+    split_idx2 = reinterpret_cast<const uint32_t*>(base + h->split_idx2_offset);
+    split_thresh = base + h->split_thresh_offset;
+    leaves = base + h->leaves_offset;
+    leaf_scales = quantized ? reinterpret_cast<const float*>(base + h->leaf_scales_offset) : 0;
+    leafBits = leaf_bits;
+
+    // Indices must stay inside the arrays they index
+    for (uint64_t i = 0; i < features; i++) {
+        if (anchors[i] >= h->num_parts) {
+            unload();
+            throw serialization_error("Not a valid compact shape predictor: " + name);
+        }
+    }
+    for (uint64_t i = 0; i < splits; i++) {
+        if (split_idx1[i] >= h->num_features || split_idx2[i] >= h->num_features) {
+            unload();
+            throw serialization_error("Not a valid compact shape predictor: " + name);
+        }
+    }
+
+    // Feature pixels as separate x and y arrays, the padding anchored to part 0
+    paddedFeatures = ((unsigned long) h->num_features + 3) / 4 * 4;
+    featureAnchors.assign((size_t) h->num_levels * paddedFeatures, 0);
+    featureDx.assign((size_t) h->num_levels * paddedFeatures, 0.f);
+    featureDy.assign((size_t) h->num_levels * paddedFeatures, 0.f);
+    for (uint32_t level = 0; level < h->num_levels; level++) {
+        for (uint32_t i = 0; i < h->num_features; i++) {
+            const uint64_t feature = (uint64_t) level * h->num_features + i;
+            featureAnchors[level * paddedFeatures + i] = anchors[feature];
+            featureDx[level * paddedFeatures + i] = deltas[2 * feature];
+            featureDy[level * paddedFeatures + i] = deltas[2 * feature + 1];
+        }
+    }
+
+    // The initial shape is the source of every level's similarity transform
+    double mean_x = 0, mean_y = 0;
+    for (uint32_t i = 0; i < h->num_parts; i++) {
+        mean_x += initial_shape[2 * i];
+        mean_y += initial_shape[2 * i + 1];
+    }
+    mean_x /= h->num_parts;
+    mean_y /= h->num_parts;
+    referenceCentered.resize(coords);
+    referenceSigma = 0;
+    for (uint32_t i = 0; i < h->num_parts; i++) {
+        referenceCentered[2 * i] = initial_shape[2 * i] - mean_x;
+        referenceCentered[2 * i + 1] = initial_shape[2 * i + 1] - mean_y;
+        referenceSigma += referenceCentered[2 * i] * referenceCentered[2 * i] +
+                          referenceCentered[2 * i + 1] * referenceCentered[2 * i + 1];
+    }
+    header = h;
+}
+
+void CompactShapePredictor::unload() {
+    if (data) munmap(data, size);
+    data = 0;
+    size = 0;
+    std::vector<char>().swap(buffer);
+    header = 0;
+    leafBits = 32;
+}
+
+void CompactShapePredictor::prefault() const {
+    if (!header) return;
+    // Ask for the whole file at once before touching it page by page
+    if (data) madvise(data, size, MADV_WILLNEED);
+    const char* base = reinterpret_cast<const char*>(header);
+    const long page = sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for (uint64_t offset = 0; offset < header->size; offset += page) sink ^= base[offset];
+    (void) sink;
+}
+
+matrix<float,2,2> CompactShapePredictor::similarity(const float* shape) const {
+    const unsigned long n = header->num_parts;
+    double mean_x = 0, mean_y = 0;
+    for (unsigned long i = 0; i < n; i++) {
+        mean_x += shape[2 * i];
+        mean_y += shape[2 * i + 1];
+    }
+    mean_x /= n;
+    mean_y /= n;
+
+    // Cross covariance [a b; c d] of the shape with the reference. The
+    // rotation and scale minimizing the squared distances, which
+    // find_similarity_transform() gets from its SVD, is then
+    // [a+d b-c; c-b a+d] over the reference's variance.
+    double a = 0, b = 0, c = 0, d = 0;
+    for (unsigned long i = 0; i < n; i++) {
+        const double to_x = shape[2 * i] - mean_x, to_y = shape[2 * i + 1] - mean_y;
+        const double from_x = referenceCentered[2 * i], from_y = referenceCentered[2 * i + 1];
+        a += to_x * from_x;
+        b += to_x * from_y;
+        c += to_y * from_x;
+        d += to_y * from_y;
+    }
+
+    matrix<float,2,2> tform;
+    if (referenceSigma == 0) {
+        tform = identity_matrix<float>(2);
+        return tform;
+    }
+    tform = (a + d) / referenceSigma, (b - c) / referenceSigma,
+            (c - b) / referenceSigma, (a + d) / referenceSigma;
+    return tform;
+}
+
+void CompactShapePredictor::placeFeatures(unsigned long level, const matrix<float,2,2>& tform, const float* shape,
+                                          float* x, float* y) const {
+    // tform * delta + anchor, as shape_predictor computes it, four features at a time
+    const simd4f m00(tform(0,0)), m01(tform(0,1)), m10(tform(1,0)), m11(tform(1,1));
+    const uint32_t* anchor = &featureAnchors[level * paddedFeatures];
+    const float* dx = &featureDx[level * paddedFeatures];
+    const float* dy = &featureDy[level * paddedFeatures];
+    for (unsigned long i = 0; i < paddedFeatures; i += 4) {
+        simd4f delta_x, delta_y;
+        delta_x.load(dx + i);
+        delta_y.load(dy + i);
+        const simd4f anchor_x(shape[2 * anchor[i]], shape[2 * anchor[i + 1]],
+                              shape[2 * anchor[i + 2]], shape[2 * anchor[i + 3]]);
+        const simd4f anchor_y(shape[2 * anchor[i] + 1], shape[2 * anchor[i + 1] + 1],
+                              shape[2 * anchor[i + 2] + 1], shape[2 * anchor[i + 3] + 1]);
+        (m00 * delta_x + m01 * delta_y + anchor_x).store(x + i);
+        (m10 * delta_x + m11 * delta_y + anchor_y).store(y + i);
+    }
+}
+
+void CompactShapePredictor::addLeaf(const float* leaf, unsigned long count, float* shape, int32_t*) {
+    unsigned long j = 0;
+    for (; j + 4 <= count; j += 4) {
+        simd4f current, delta;
+        current.load(shape + j);
+        delta.load(leaf + j);
+        (current + delta).store(shape + j);
+    }
+    for (; j < count; j++) shape[j] += leaf[j];
+}
@@ -0,0 +1,263 @@
+#ifndef __COMPACT_SHAPE_PREDICTOR
+#define __COMPACT_SHAPE_PREDICTOR
+
+#include <dlib/image_processing.h>
+
+#include "shape_predictor_data.hpp"
+
+#include <stdint.h>
+#include <climits>
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Version of the compact layout written by writeCompactShapePredictor(),
+// version 1 files (float only) are still read
+const static uint32_t COMPACT_SHAPE_PREDICTOR_VERSION = 2;
+
+/** Header of a compact shape predictor file. Every section is a flat array
+ *  of 32 bit values (narrower for the quantized leaves and thresholds) in
+ *  native (little endian) byte order, starting on a 64
+ *  byte boundary at the offset given here, so the file is used as mapped.
+ *  Splits and leaves are per level, per tree, in breadth-first order.
+ *
+ *  Quantized files store each leaf value as an integer times the scale of its
+ *  cascade level, and the split thresholds as integers: the pixel differences
+ *  they are compared with are integers, so floor(thresh) decides the same.
+ */
+struct CompactShapePredictorHeader {
+    char magic[8];                  // "HPESHAPE"
+    uint32_t version;
+    uint32_t num_parts;
+    uint32_t num_levels;            // cascade levels
+    uint32_t num_trees;             // trees per level
+    uint32_t num_splits;            // splits per tree, leaves are one more
+    uint32_t num_features;          // feature pixels per level
+
+    uint64_t landmarks_offset;      // uint32 [num_parts], landmark in the full model
+    uint64_t initial_shape_offset;  // float [num_parts][2]
+    uint64_t anchors_offset;        // uint32 [num_levels][num_features]
+    uint64_t deltas_offset;         // float [num_levels][num_features][2]
+    uint64_t split_idx1_offset;     // uint32 [num_levels][num_trees][num_splits]
+    uint64_t split_idx2_offset;     // uint32 [num_levels][num_trees][num_splits]
+    uint64_t split_thresh_offset;   // thresh_bits [num_levels][num_trees][num_splits]
+    uint64_t leaves_offset;         // leaf_bits [num_levels][num_trees][num_splits + 1][num_parts][2]
+    uint64_t size;                  // of the whole file
+
+    // Version 2, zero (float) in version 1 files
+    uint32_t leaf_bits;             // 32 float, 16 or 8 signed integer
+    uint32_t thresh_bits;           // 32 float, 16 signed integer
+    uint64_t leaf_scales_offset;    // float [num_levels], integer leaves only
+};
+
+/** Writes a shape predictor in the compact layout. landmarks gives the index
+ *  in the full model of each of its landmarks, empty when it is the full one.
+ *  leaf_bits 16 or 8 quantizes the leaves, 2 or 4 times smaller, each leaf
+ *  rounded to the nearest multiple of its level's scale. What that costs in
+ *  landmark accuracy has not been measured; tools/benchmark_shape_predictor
+ *  reports it for a given model and test set.
+ *  Throws dlib::serialization_error if the trees are not all of one depth.
+ */
+void writeCompactShapePredictor(const ShapePredictorData& data,
+                                const std::vector<unsigned long>& landmarks, std::ostream& out,
+                                int leaf_bits = 32);
+
+/** dlib::shape_predictor working straight out of a read-only memory mapped
+ *  compact file: loading is a single mmap, only the few KB of feature pixel
+ *  offsets are copied, and the pages are shared by every process using the
+ *  same model. It can also be built in memory from a parsed model.
+ *
+ *  Each cascade level is flat breadth-first arrays. The feature pixels of a
+ *  level are placed four at a time with SIMD, the similarity transform to the
+ *  mean shape is solved in closed form, and float leaves are added four
+ *  coordinates at a time. Predictions are the ones of the shape_predictor
+ *  the model was converted from, to floating point rounding.
+ */
+class CompactShapePredictor {
+
+public:
+    CompactShapePredictor();
+    ~CompactShapePredictor();
+
+    /** True when the file starts like a compact shape predictor.
+     */
+    static bool isCompact(const std::string& path);
+
+    /** Maps a file written by writeCompactShapePredictor(), dropping any
+     *  previous one. Throws dlib::serialization_error when it cannot.
+     */
+    void load(const std::string& path);
+
+    /** Lays out a parsed model in memory, dropping any previous one. landmarks
+     *  as for writeCompactShapePredictor().
+     */
+    void assign(const ShapePredictorData& model, const std::vector<unsigned long>& landmarks);
+
+    /** Drops the model, mapped or in memory.
+     */
+    void unload();
+
+    /** Reads a byte of every page of the model, so that the first
+     *  predictions do not stall on page faults.
+     */
+    void prefault() const;
+
+    bool empty() const { return header == 0; }
+
+    unsigned long num_parts() const { return header ? header->num_parts : 0; }
+
+    unsigned long num_levels() const { return header ? header->num_levels : 0; }
+
+    /** 32 for float leaves, 16 or 8 for a quantized model.
+     */
+    unsigned long leaf_bits() const { return leafBits; }
+
+    /** Index in the full model of landmark i.
+     */
+    unsigned long landmark(unsigned long i) const { return landmarks[i]; }
+
+    /** Landmarks of the face in rect, running the first levels of the cascade
+     *  only, all of them by default. Cost is linear in the levels run.
+     */
+    template <typename image_type>
+    dlib::full_object_detection operator()(const image_type& img, const dlib::rectangle& rect,
+                                           unsigned long levels = ULONG_MAX) const;
+
+private:
+    CompactShapePredictor(const CompactShapePredictor&);
+    CompactShapePredictor& operator=(const CompactShapePredictor&);
+
+    /** Checks the layout at base and points the sections into it.
+     */
+    void attach(const char* base, size_t length, const std::string& name);
+
+    template <typename leaf_type, typename thresh_type, typename image_type>
+    dlib::full_object_detection predict(const image_type& img, const dlib::rectangle& rect,
+                                        unsigned long levels) const;
+
+    /** 2x2 part of the similarity transform from initial_shape to shape, as
+     *  dlib::impl::find_tform_between_shapes() has it.
+     */
+    dlib::matrix<float,2,2> similarity(const float* shape) const;
+
+    /** Positions of the feature pixels of a level in shape coordinates.
+     */
+    void placeFeatures(unsigned long level, const dlib::matrix<float,2,2>& tform, const float* shape,
+                       float* x, float* y) const;
+
+    /** Index of the leaf the features lead to in a tree.
+     */
+    template <typename thresh_type>
+    unsigned long findLeaf(unsigned long tree, const float* features) const;
+
+    static void addLeaf(const float* leaf, unsigned long count, float* shape, int32_t* sums);
+
+    template <typename T>
+    static void addLeaf(const T* leaf, unsigned long count, float*, int32_t* sums) {
+        for (unsigned long j = 0; j < count; j++) sums[j] += leaf[j];
+    }
+
+    // Mapped file, or the model laid out in memory
+    void* data;
+    size_t size;
+    std::vector<char> buffer;
+
+    const CompactShapePredictorHeader* header;
+    const uint32_t* landmarks;
+    const float* initial_shape;
+    const uint32_t* split_idx1;
+    const uint32_t* split_idx2;
+    const void* split_thresh;
+    const void* leaves;
+    const float* leaf_scales;
+    unsigned long leafBits;
+
+    // Feature pixels of every level, structure of arrays padded to a multiple
+    // of 4 per level
+    unsigned long paddedFeatures;
+    std::vector<uint32_t> featureAnchors;
+    std::vector<float> featureDx, featureDy;
+
+    // initial_shape around its mean, and its variance
+    std::vector<double> referenceCentered;
+    double referenceSigma;
+};
+
+template <typename image_type>
+dlib::full_object_detection CompactShapePredictor::operator()(const image_type& img,
+                                                              const dlib::rectangle& rect,
+                                                              unsigned long levels) const {
+    DLIB_ASSERT(header != 0, "No compact shape predictor loaded");
+    levels = std::min<unsigned long>(levels, header->num_levels);
+    if (leafBits == 16) return predict<int16_t, int16_t>(img, rect, levels);
+    if (leafBits == 8) return predict<int8_t, int16_t>(img, rect, levels);
+    return predict<float, float>(img, rect, levels);
+}
+
+template <typename thresh_type>
+unsigned long CompactShapePredictor::findLeaf(unsigned long tree, const float* features) const {
+    const unsigned long first = tree * header->num_splits;
+    const thresh_type* thresholds = static_cast<const thresh_type*>(split_thresh) + first;
+    unsigned long i = 0;
+    while (i < header->num_splits) {
+        if (features[split_idx1[first + i]] - features[split_idx2[first + i]] > thresholds[i])
+            i = 2 * i + 1;
+        else
+            i = 2 * i + 2;
+    }
+    return i - header->num_splits;
+}
+
+template <typename leaf_type, typename thresh_type, typename image_type>
+dlib::full_object_detection CompactShapePredictor::predict(const image_type& img,
+                                                           const dlib::rectangle& rect,
+                                                           unsigned long levels) const {
+    using namespace dlib;
+    const bool quantized = leafBits < 32;
+    const unsigned long num_coords = 2 * header->num_parts;
+    const unsigned long num_leaves = header->num_splits + 1;
+    const leaf_type* leaf_values = static_cast<const leaf_type*>(leaves);
+
+    // Padded for the 4 wide adds
+    std::vector<float> shape((num_coords + 3) / 4 * 4, 0.f);
+    std::copy(initial_shape, initial_shape + num_coords, shape.begin());
+    std::vector<int32_t> level_sum(shape.size(), 0);
+    std::vector<float> x(paddedFeatures), y(paddedFeatures), feature_pixel_values(paddedFeatures);
+
+    const point_transform_affine tform_to_img = impl::unnormalizing_tform(rect);
+    const rectangle area = get_rect(img);
+    const_image_view<image_type> view(img);
+
+    for (unsigned long level = 0; level < levels; level++) {
+        // Sample the feature pixels, anchored to the current shape
+        placeFeatures(level, similarity(&shape[0]), &shape[0], &x[0], &y[0]);
+        for (unsigned long i = 0; i < header->num_features; i++) {
+            const point p = tform_to_img(dlib::vector<float,2>(x[i], y[i]));
+            if (area.contains(p))
+                feature_pixel_values[i] = get_pixel_intensity(view[p.y()][p.x()]);
+            else
+                feature_pixel_values[i] = 0;
+        }
+
+        // Walk every tree of the level and add up their leaves. Integer leaves
+        // add up exactly, and are scaled once per level.
+        for (unsigned long tree = level * header->num_trees; tree < (level + 1) * header->num_trees; tree++) {
+            const unsigned long leaf = findLeaf<thresh_type>(tree, &feature_pixel_values[0]);
+            addLeaf(leaf_values + (tree * num_leaves + leaf) * num_coords, num_coords, &shape[0], &level_sum[0]);
+        }
+        if (quantized) {
+            for (unsigned long j = 0; j < num_coords; j++) {
+                shape[j] += leaf_scales[level] * level_sum[j];
+                level_sum[j] = 0;
+            }
+        }
+    }
+
+    std::vector<point> parts(header->num_parts);
+    for (unsigned long i = 0; i < parts.size(); i++)
+        parts[i] = tform_to_img(dlib::vector<float,2>(shape[2 * i], shape[2 * i + 1]));
+    return full_object_detection(rect, parts);
+}
+
+#endif // __COMPACT_SHAPE_PREDICTOR
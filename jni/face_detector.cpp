@@ -0,0 +1,553 @@
+#include "face_detector.hpp"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+
+using namespace dlib;
+using namespace std;
+
+namespace {
+    // Levels spanning at least two of these in a direction get split into tiles
+    const long TILE_SIZE = 512;
+
+    const long UNBOUNDED = std::numeric_limits<long>::max() / 2;
+
+    // Start of a file FaceDetector::serialize() wrote
+    const char PREBUILT_MAGIC[8] = { 'H', 'P', 'E', 'F', 'H', 'O', 'G', 'D' };
+    const int PREBUILT_VERSION = 1;
+
+    // Size ratio between the levels built by pyramid_down<6>
+    const double DLIB_PYRAMID_STEP = 6. / 5.;
+
+    inline long alignDown(long x, long cell_size) {
+        return (x / cell_size) * cell_size;
+    }
+
+    /** Bounding boxes, in blocks, of the connected groups of changed blocks.
+     */
+    void changedRegions(const cv::Mat& changed, std::vector<cv::Rect>& regions) {
+        cv::Mat labels, stats, centroids;
+        const int count = cv::connectedComponentsWithStats(changed, labels, stats, centroids, 8, CV_32S);
+        // Label 0 is the unchanged background
+        for (int i = 1; i < count; ++i) {
+            regions.push_back(cv::Rect(stats.at<int>(i, cv::CC_STAT_LEFT), stats.at<int>(i, cv::CC_STAT_TOP),
+                                       stats.at<int>(i, cv::CC_STAT_WIDTH), stats.at<int>(i, cv::CC_STAT_HEIGHT)));
+        }
+    }
+
+    /** Merges overlapping rectangles until none overlap, so that no window is
+     *  scanned twice.
+     */
+    void mergeOverlapping(std::vector<dlib::rectangle>& rects) {
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (unsigned long i = 0; i < rects.size(); ++i) {
+                for (unsigned long j = i + 1; j < rects.size(); ++j) {
+                    if (rects[i].intersect(rects[j]).is_empty()) continue;
+                    rects[i] += rects[j];
+                    rects.erase(rects.begin() + j);
+                    merged = true;
+                    --j;
+                }
+            }
+        }
+    }
+
+    inline bool containsAny(const std::vector<dlib::rectangle>& rects, const dlib::point& p) {
+        for (unsigned long i = 0; i < rects.size(); ++i)
+            if (rects[i].contains(p)) return true;
+        return false;
+    }
+}
+
+/** Everything one call works on. Tiles and their scanners are per level, the
+ *  scanners keep the HOG features of their tile for the fallback pass.
+ */
+struct FaceDetector::Scan {
+    std::vector<Level> levels;
+    dlib::array<array2d<bgr_pixel> > downsampled;
+
+    std::vector<std::vector<Tile> > tiles;
+    std::vector<std::vector<std::unique_ptr<scanner_type> > > scanners;
+
+    // Only set up when the previous frame's detections can be reused
+    std::vector<ScanCache::LevelDetections> previous;
+    std::vector<std::vector<dlib::rectangle> > motion_cores;
+    std::vector<std::vector<Tile> > motion_tiles;
+    std::vector<std::vector<std::unique_ptr<scanner_type> > > motion_scanners;
+
+    // What this call found, becomes the cache of the next one
+    std::vector<ScanCache::LevelDetections> current;
+};
+
+FaceDetector::FaceDetector(const frontal_face_detector& detector) :
+    overlap_tester(detector.get_overlap_tester()) {
+    scanner.copy_configuration(detector.get_scanner());
+
+    // Build the filters once, object_detector does it on every copy
+    for (unsigned long i = 0; i < detector.num_detectors(); ++i) {
+        const scanner_type::feature_vector_type& w = detector.get_w(i);
+        filterbanks.push_back(scanner.build_fhog_filterbank(w));
+        thresholds.push_back(w(scanner.get_num_dimensions()));
+    }
+}
+
+FaceDetector::FaceDetector(std::istream& in) {
+    char magic[sizeof(PREBUILT_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, PREBUILT_MAGIC, sizeof(magic)) != 0)
+        throw serialization_error("Not a prebuilt face detector.");
+    int version = 0;
+    deserialize(version, in);
+    if (version != PREBUILT_VERSION)
+        throw serialization_error("Unexpected version found while deserializing a prebuilt face detector.");
+
+    deserialize(scanner, in);
+    deserialize(overlap_tester, in);
+    deserialize(thresholds, in);
+    unsigned long num_detectors = 0;
+    deserialize(num_detectors, in);
+    if (num_detectors != thresholds.size())
+        throw serialization_error("Corrupt prebuilt face detector: filter and threshold counts differ.");
+    filterbanks.resize(num_detectors);
+    for (unsigned long i = 0; i < num_detectors; ++i) {
+        deserialize(filterbanks[i].filters, in);
+        deserialize(filterbanks[i].row_filters, in);
+        deserialize(filterbanks[i].col_filters, in);
+    }
+}
+
+void FaceDetector::serialize(std::ostream& out) const {
+    out.write(PREBUILT_MAGIC, sizeof(PREBUILT_MAGIC));
+    dlib::serialize(PREBUILT_VERSION, out);
+
+    dlib::serialize(scanner, out);
+    dlib::serialize(overlap_tester, out);
+    dlib::serialize(thresholds, out);
+    dlib::serialize((unsigned long) filterbanks.size(), out);
+    for (unsigned long i = 0; i < filterbanks.size(); ++i) {
+        dlib::serialize(filterbanks[i].filters, out);
+        dlib::serialize(filterbanks[i].row_filters, out);
+        dlib::serialize(filterbanks[i].col_filters, out);
+    }
+}
+
+bool FaceDetector::isPrebuilt(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    char magic[sizeof(PREBUILT_MAGIC)];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, PREBUILT_MAGIC, sizeof(magic)) == 0;
+}
+
+std::vector<rect_detection> FaceDetector::operator()(const cv::Mat& image, thread_pool& pool,
+                                                     const DetectionOptions& options,
+                                                     ScanCache* cache) const {
+    std::vector<rect_detection> final_dets;
+    if (image.empty()) {
+        if (cache) cache->levels.clear();
+        return final_dets;
+    }
+
+    Scan scan;
+    buildPyramid(image, options, scan.levels, scan.downsampled);
+    const unsigned long num_levels = scan.levels.size();
+
+    scan.tiles.resize(num_levels);
+    scan.scanners.resize(num_levels);
+    for (unsigned long l = 0; l < num_levels; ++l) {
+        tileLevel(scan.levels[l].image.cols, scan.levels[l].image.rows, scan.tiles[l]);
+        scan.scanners[l].resize(scan.tiles[l].size());
+    }
+    scan.current.resize(num_levels);
+
+    // The previous detections stand in for the unchanged regions as long as
+    // the pyramid is the same one
+    if (cache && !cache->changed.empty() &&
+        cache->image_size == image.size() &&
+        cache->options.min_face_size == options.min_face_size &&
+        cache->options.max_face_size == options.max_face_size &&
+        cache->options.pyramid_step == options.pyramid_step &&
+        cache->levels.size() == num_levels) {
+        scan.previous.swap(cache->levels);
+        std::vector<cv::Rect> regions;
+        changedRegions(cache->changed, regions);
+        scan.motion_cores.resize(num_levels);
+        scan.motion_tiles.resize(num_levels);
+        scan.motion_scanners.resize(num_levels);
+        for (unsigned long l = 0; l < num_levels; ++l) {
+            motionCores(image, scan.levels[l], cache->changed, regions, scan.motion_cores[l]);
+            motionTiles(scan.tiles[l], scan.motion_cores[l], scan.motion_tiles[l]);
+            scan.motion_scanners[l].resize(scan.motion_tiles[l].size());
+        }
+    }
+
+    std::vector<rect_detection> dets;
+    final_dets = scanPyramid(scan, options.filters, options, pool, dets);
+
+    const unsigned long fallback = options.fallback_filters & ~options.filters;
+    if (final_dets.empty() && fallback != 0)
+        final_dets = scanPyramid(scan, fallback, options, pool, dets);
+
+    if (cache) {
+        cache->image_size = image.size();
+        cache->options = options;
+        cache->levels.swap(scan.current);
+    }
+
+    keepBest(final_dets, options);
+    return final_dets;
+}
+
+/** Scans the pyramid with the filters selected by mask, adding the raw
+ *  detections to dets, and returns them after non-max suppression.
+ *
+ *  With max_faces and stop_confidence set, the levels are scanned from the
+ *  coarsest one, a few at a time, and the scan stops as soon as max_faces
+ *  confident faces are known: the large faces come first and the expensive
+ *  fine levels are skipped.
+ */
+std::vector<rect_detection> FaceDetector::scanPyramid(Scan& scan, unsigned long mask,
+        const DetectionOptions& options, thread_pool& pool,
+        std::vector<rect_detection>& dets) const {
+    if (options.max_faces == 0 || options.stop_confidence <= 0) {
+        scanLevels(scan, 0, scan.levels.size(), mask, pool, dets);
+        return suppress(dets);
+    }
+
+    // Batches of whole levels with at least one tile per thread
+    const unsigned long batch = std::max(1UL, pool.num_threads_in_pool());
+    std::vector<rect_detection> final_dets;
+    unsigned long end = scan.levels.size();
+    while (end > 0) {
+        unsigned long begin = end - 1;
+        unsigned long num_tiles = scan.tiles[begin].size();
+        while (begin > 0 && num_tiles < batch)
+            num_tiles += scan.tiles[--begin].size();
+
+        scanLevels(scan, begin, end, mask, pool, dets);
+        final_dets = suppress(dets);
+
+        unsigned long confident = 0;
+        for (unsigned long i = 0; i < final_dets.size(); ++i)
+            if (final_dets[i].detection_confidence >= options.stop_confidence) confident++;
+        if (confident >= options.max_faces) break;
+
+        end = begin;
+    }
+    return final_dets;
+}
+
+/** Scans levels [begin, end) with the filters selected by mask, all their
+ *  tiles in parallel, and appends the detections to dets in input image
+ *  coordinates. Levels with usable previous detections only scan the parts
+ *  of tiles around each changed region and carry over the rest.
+ */
+void FaceDetector::scanLevels(Scan& scan, unsigned long begin, unsigned long end,
+                              unsigned long mask, thread_pool& pool,
+                              std::vector<rect_detection>& dets) const {
+    struct Job {
+        unsigned long level;
+        const Tile* tile;
+        std::unique_ptr<scanner_type>* scanner;
+    };
+
+    std::vector<Job> jobs;
+    for (unsigned long l = begin; l < end; ++l) {
+        ScanCache::LevelDetections& current = scan.current[l];
+        current.filters |= mask;
+
+        const bool incremental = !scan.previous.empty() &&
+                                 (scan.previous[l].filters & mask) == mask;
+        std::vector<Tile>& tiles = incremental ? scan.motion_tiles[l] : scan.tiles[l];
+        std::vector<std::unique_ptr<scanner_type> >& scanners =
+            incremental ? scan.motion_scanners[l] : scan.scanners[l];
+
+        if (incremental) {
+            const std::vector<rect_detection>& previous = scan.previous[l].dets;
+            for (unsigned long i = 0; i < previous.size(); ++i) {
+                if ((mask & (1UL << previous[i].weight_index)) &&
+                    !containsAny(scan.motion_cores[l], previous[i].rect.tl_corner()))
+                    current.dets.push_back(previous[i]);
+            }
+        }
+
+        for (unsigned long i = 0; i < tiles.size(); ++i) {
+            Job job = { l, &tiles[i], &scanners[i] };
+            jobs.push_back(job);
+        }
+    }
+
+    // Each job writes only to its own slot
+    std::vector<std::vector<rect_detection> > job_dets(jobs.size());
+    parallel_for(pool, 0, jobs.size(), [&](long i) {
+        scanTile(scan.levels[jobs[i].level], *jobs[i].tile, *jobs[i].scanner, mask, job_dets[i]);
+    });
+
+    for (unsigned long i = 0; i < jobs.size(); ++i) {
+        std::vector<rect_detection>& level_dets = scan.current[jobs[i].level].dets;
+        level_dets.insert(level_dets.end(), job_dets[i].begin(), job_dets[i].end());
+    }
+
+    for (unsigned long l = begin; l < end; ++l) {
+        const std::vector<rect_detection>& level_dets = scan.current[l].dets;
+        for (unsigned long i = 0; i < level_dets.size(); ++i) {
+            if (!(mask & (1UL << level_dets[i].weight_index))) continue;
+
+            rect_detection det = level_dets[i];
+            det.rect = toImage(scan.levels[l], det.rect);
+            dets.push_back(det);
+        }
+    }
+}
+
+/** Non-max suppression, same as object_detector::operator().
+ */
+std::vector<rect_detection> FaceDetector::suppress(std::vector<rect_detection>& dets) const {
+    std::stable_sort(dets.begin(), dets.end(),
+        [](const rect_detection& a, const rect_detection& b) {
+            return a.detection_confidence > b.detection_confidence;
+        });
+
+    std::vector<rect_detection> final_dets;
+    for (unsigned long i = 0; i < dets.size(); ++i) {
+        bool overlaps = false;
+        for (unsigned long j = 0; j < final_dets.size() && !overlaps; ++j)
+            overlaps = overlap_tester(final_dets[j].rect, dets[i].rect);
+
+        if (!overlaps) final_dets.push_back(dets[i]);
+    }
+    return final_dets;
+}
+
+/** Keeps the max_faces best detections, either the most confident or the
+ *  largest ones.
+ */
+void FaceDetector::keepBest(std::vector<rect_detection>& dets, const DetectionOptions& options) const {
+    if (options.max_faces == 0 || dets.size() <= options.max_faces) return;
+
+    // dets are already sorted by confidence
+    if (options.rank_by == RANK_BY_AREA) {
+        std::stable_sort(dets.begin(), dets.end(),
+            [](const rect_detection& a, const rect_detection& b) {
+                return a.rect.area() > b.rect.area();
+            });
+    }
+    dets.resize(options.max_faces);
+}
+
+/** Builds the levels to scan. With default options this is the pyramid
+ *  scan_fhog_pyramid::load() would build: same stopping rule, same
+ *  pyramid_down<6> images. A minimum face size shrinks the base level so that
+ *  the finer levels are never built, a maximum one drops the coarse levels that
+ *  only hold bigger faces, and a custom step resamples with cv::resize.
+ */
+void FaceDetector::buildPyramid(const cv::Mat& image, const DetectionOptions& options,
+                                std::vector<Level>& levels,
+                                dlib::array<array2d<bgr_pixel> >& downsampled) const {
+    const double window = std::max(scanner.get_detection_window_width(),
+                                   scanner.get_detection_window_height());
+    const bool dlib_steps = options.pyramid_step <= 1 ||
+                            std::abs(options.pyramid_step - DLIB_PYRAMID_STEP) < 1e-6;
+    const double step = dlib_steps ? DLIB_PYRAMID_STEP : options.pyramid_step;
+
+    // A level at scale s finds faces of about window/s pixels
+    cv::Mat base = image;
+    if (options.min_face_size > window) {
+        const double scale = window / options.min_face_size;
+        cv::resize(image, base, cv::Size(), scale, scale, cv::INTER_AREA);
+    }
+    const double min_scale = options.max_face_size > 0 ?
+        window / (options.max_face_size * std::sqrt(step)) : 0;
+
+    // Level sizes, the first checks are the ones of dlib's create_fhog_pyramid()
+    pyramid_type pyr;
+    std::vector<dlib::rectangle> rects(1, dlib::rectangle(base.cols, base.rows));
+    while (rects.size() < scanner.get_max_pyramid_levels()) {
+        const dlib::rectangle& last = rects.back();
+        const dlib::rectangle next = dlib_steps ? pyr.rect_down(last) :
+            dlib::rectangle((unsigned long)std::floor(last.width() / step + 0.5),
+                            (unsigned long)std::floor(last.height() / step + 0.5));
+
+        if (next.width() < scanner.get_min_pyramid_layer_width() ||
+            next.height() < scanner.get_min_pyramid_layer_height())
+            break;
+        if ((double)next.width() / image.cols < min_scale)
+            break;
+        rects.push_back(next);
+    }
+
+    levels.resize(rects.size());
+    downsampled.resize(dlib_steps ? rects.size() - 1 : 0);
+    for (unsigned long l = 0; l < levels.size(); ++l) {
+        Level& level = levels[l];
+        if (l == 0) {
+            level.image = base;
+        } else if (dlib_steps) {
+            if (l == 1)
+                pyr(cv_image<bgr_pixel>(base), downsampled[0]);
+            else
+                pyr(downsampled[l-2], downsampled[l-1]);
+            level.image = toMat(downsampled[l-1]);
+        } else {
+            cv::resize(levels[l-1].image, level.image,
+                       cv::Size(rects[l].width(), rects[l].height()), 0, 0, cv::INTER_AREA);
+        }
+
+        // pyramid_down only applies to the dlib steps above the base
+        level.pyr_steps = dlib_steps ? l : 0;
+        const cv::Mat& src = dlib_steps ? base : level.image;
+        level.sx = (double)image.cols / src.cols;
+        level.sy = (double)image.rows / src.rows;
+    }
+}
+
+/** Maps a rectangle of a level back to the input image.
+ */
+dlib::rectangle FaceDetector::toImage(const Level& level, const dlib::rectangle& rect) const {
+    pyramid_type pyr;
+    const dlib::rectangle r = pyr.rect_up(rect, level.pyr_steps);
+    if (level.sx == 1 && level.sy == 1) return r;
+
+    return dlib::rectangle((long)std::floor(r.left() * level.sx + 0.5),
+                           (long)std::floor(r.top() * level.sy + 0.5),
+                           (long)std::floor((r.right() + 1) * level.sx + 0.5) - 1,
+                           (long)std::floor((r.bottom() + 1) * level.sy + 0.5) - 1);
+}
+
+/** Splits a pyramid level of size nc x nr into tiles. Tile origins stay on the
+ *  HOG cell grid so that the features of a tile match those of the full level
+ *  away from its borders.
+ */
+void FaceDetector::tileLevel(long nc, long nr, std::vector<Tile>& tiles) const {
+    const long cell_size = scanner.get_cell_size();
+    // Gradients, cell binning and block normalization each reach about one cell
+    const long halo = 4 * cell_size;
+    const long reach_x = scanner.get_detection_window_width() + 2 * cell_size + halo;
+    const long reach_y = scanner.get_detection_window_height() + 2 * cell_size + halo;
+
+    const long cols = std::max(1L, nc / TILE_SIZE);
+    const long rows = std::max(1L, nr / TILE_SIZE);
+
+    for (long r = 0; r < rows; ++r) {
+        for (long c = 0; c < cols; ++c) {
+            const long left = c * TILE_SIZE;
+            const long top = r * TILE_SIZE;
+            const long right = (c == cols - 1) ? nc - 1 : left + TILE_SIZE - 1;
+            const long bottom = (r == rows - 1) ? nr - 1 : top + TILE_SIZE - 1;
+
+            // Windows hanging over the image border belong to the outer tiles
+            Tile tile;
+            tile.core = dlib::rectangle(c == 0 ? -UNBOUNDED : left,
+                                        r == 0 ? -UNBOUNDED : top,
+                                        c == cols - 1 ? UNBOUNDED : right,
+                                        r == rows - 1 ? UNBOUNDED : bottom);
+            tile.area = dlib::rectangle(std::max(0L, left - halo),
+                                        std::max(0L, top - halo),
+                                        std::min(nc - 1, right + reach_x),
+                                        std::min(nr - 1, bottom + reach_y));
+            tiles.push_back(tile);
+        }
+    }
+}
+
+/** Top left corners, in level coordinates, of the windows whose HOG features
+ *  can see each changed region, merged where they overlap. Empty when nothing
+ *  changed.
+ */
+void FaceDetector::motionCores(const cv::Mat& image, const Level& level, const cv::Mat& changed,
+                               const std::vector<cv::Rect>& regions,
+                               std::vector<dlib::rectangle>& cores) const {
+    // Changed pixels of the input, then of the level, rounded outwards
+    const double bx = (double)image.cols / changed.cols;
+    const double by = (double)image.rows / changed.rows;
+    const double fx = (double)level.image.cols / image.cols;
+    const double fy = (double)level.image.rows / image.rows;
+
+    const long cell_size = scanner.get_cell_size();
+    const long halo = 4 * cell_size;
+    const long width = scanner.get_detection_window_width() + 2 * cell_size;
+    const long height = scanner.get_detection_window_height() + 2 * cell_size;
+
+    for (unsigned long i = 0; i < regions.size(); ++i) {
+        const cv::Rect& blocks = regions[i];
+        const dlib::rectangle box((long)std::floor(blocks.x * bx * fx) - 1,
+                                  (long)std::floor(blocks.y * by * fy) - 1,
+                                  (long)std::ceil(blocks.br().x * bx * fx) + 1,
+                                  (long)std::ceil(blocks.br().y * by * fy) + 1);
+        cores.push_back(dlib::rectangle(box.left() - width - halo, box.top() - height - halo,
+                                        box.right() + halo, box.bottom() + halo));
+    }
+    mergeOverlapping(cores);
+}
+
+/** Shrinks the tiles of a level to the windows of each core, one motion tile
+ *  per tile and core they share, dropping those left with none.
+ */
+void FaceDetector::motionTiles(const std::vector<Tile>& tiles, const std::vector<dlib::rectangle>& cores,
+                               std::vector<Tile>& motion_tiles) const {
+    const long cell_size = scanner.get_cell_size();
+    const long halo = 4 * cell_size;
+    const long reach_x = scanner.get_detection_window_width() + 2 * cell_size + halo;
+    const long reach_y = scanner.get_detection_window_height() + 2 * cell_size + halo;
+
+    for (unsigned long i = 0; i < tiles.size(); ++i) {
+        for (unsigned long c = 0; c < cores.size(); ++c) {
+            Tile tile;
+            tile.core = tiles[i].core.intersect(cores[c]);
+            if (tile.core.is_empty()) continue;
+
+            // Keep the area on the HOG cell grid
+            const dlib::rectangle& area = tiles[i].area;
+            tile.area = dlib::rectangle(
+                std::max(area.left(), alignDown(std::max(0L, tile.core.left() - halo), cell_size)),
+                std::max(area.top(), alignDown(std::max(0L, tile.core.top() - halo), cell_size)),
+                std::min(area.right(), tile.core.right() + reach_x),
+                std::min(area.bottom(), tile.core.bottom() + reach_y));
+            if (tile.area.is_empty()) continue;
+
+            motion_tiles.push_back(tile);
+        }
+    }
+}
+
+/** Runs the filters selected by mask over one tile and collects the detections
+ *  it owns, in level coordinates. The tile's HOG features are computed on first
+ *  use.
+ */
+void FaceDetector::scanTile(const Level& level, const Tile& tile,
+                            std::unique_ptr<scanner_type>& tile_scanner,
+                            unsigned long mask, std::vector<rect_detection>& dets) const {
+    if (!tile_scanner) {
+        tile_scanner.reset(new scanner_type());
+        tile_scanner->copy_configuration(scanner);
+        tile_scanner->set_max_pyramid_levels(1);
+
+        const cv::Mat roi = level.image(cv::Rect(tile.area.left(), tile.area.top(),
+                                                 tile.area.width(), tile.area.height()));
+        tile_scanner->load(cv_image<bgr_pixel>(roi));
+    }
+
+    std::vector<std::pair<double, dlib::rectangle> > raw;
+    for (unsigned long i = 0; i < filterbanks.size(); ++i) {
+        if (!(mask & (1UL << i))) continue;
+
+        raw.clear();
+        tile_scanner->detect(filterbanks[i], raw, thresholds[i]);
+
+        for (unsigned long j = 0; j < raw.size(); ++j) {
+            const dlib::rectangle rect = translate_rect(raw[j].second, tile.area.tl_corner());
+            if (!tile.core.contains(rect.tl_corner())) continue;
+
+            rect_detection det;
+            det.detection_confidence = raw[j].first - thresholds[i];
+            det.weight_index = i;
+            det.rect = rect;
+            dets.push_back(det);
+        }
+    }
+}
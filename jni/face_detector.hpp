@@ -0,0 +1,185 @@
+#ifndef __FACE_DETECTOR
+#define __FACE_DETECTOR
+
+#include <opencv2/core/core.hpp>
+#include <dlib/opencv.h>
+#include <dlib/image_processing.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/threads/thread_pool_extension.h>
+#include <dlib/threads/parallel_for_extension.h>
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Sub-detectors of dlib's frontal_face_detector, one bit each in the order it stores them
+const static unsigned long FACE_FRONT = 1 << 0;
+const static unsigned long FACE_LEFT_PROFILE = 1 << 1;
+const static unsigned long FACE_RIGHT_PROFILE = 1 << 2;
+const static unsigned long FACE_FRONT_ROTATED_LEFT = 1 << 3;
+const static unsigned long FACE_FRONT_ROTATED_RIGHT = 1 << 4;
+const static unsigned long FACE_ALL = 0x1f;
+
+// How the detections are ranked when only the best ones are kept
+const static int RANK_BY_CONFIDENCE = 0;
+const static int RANK_BY_AREA = 1;
+
+/** Which part of the search space a FaceDetector call covers.
+ */
+struct DetectionOptions {
+    DetectionOptions() : min_face_size(0), max_face_size(0), pyramid_step(0),
+        filters(FACE_ALL), fallback_filters(0),
+        max_faces(0), rank_by(RANK_BY_CONFIDENCE), stop_confidence(0) {}
+
+    // Smallest face side in pixels, 0 (or anything below the detection window)
+    // searches from the window size, the finest level dlib scans
+    long min_face_size;
+    // Largest face side in pixels, 0 for no limit
+    long max_face_size;
+    // Size ratio between consecutive pyramid levels, 0 keeps dlib's 6/5
+    double pyramid_step;
+
+    // Sub-detectors evaluated at every location
+    unsigned long filters;
+    // Sub-detectors evaluated only when the ones in filters find no face,
+    // e.g. FACE_FRONT first and the profiles as fallback
+    unsigned long fallback_filters;
+
+    // Number of faces kept, 0 for all of them, ranked by rank_by
+    unsigned long max_faces;
+    int rank_by;
+    // When positive, stop scanning once max_faces faces at least this confident
+    // are found, coarse (large face) levels first
+    double stop_confidence;
+};
+
+/** Raw detections of the previous frame, kept by the caller between calls so
+ *  that the regions that did not change need not be scanned again.
+ */
+struct ScanCache {
+    // Set by the caller before each call: one byte per block of the frame,
+    // non zero where it changed since the previous frame. Empty to scan it all.
+    cv::Mat changed;
+
+    // Everything below is owned by the detector
+    struct LevelDetections {
+        LevelDetections() : filters(0) {}
+
+        // Sub-detectors the detections are complete for
+        unsigned long filters;
+        // Before non-max suppression, in level coordinates
+        std::vector<dlib::rect_detection> dets;
+    };
+
+    cv::Size image_size;
+    DetectionOptions options;
+    std::vector<LevelDetections> levels;
+};
+
+/** Multi-threaded front-end for a dlib::frontal_face_detector.
+ *
+ *  dlib scans the HOG pyramid one level after the other on the calling thread.
+ *  Here every pyramid level, and every tile of the large ones, is an independent
+ *  task on a thread pool. Tiles overlap enough for each detection window to be
+ *  seen whole by the tile that owns it, so the raw detections are the ones dlib
+ *  would find; they then go through the same non-max suppression as
+ *  object_detector, which makes the output identical to detector(image).
+ *
+ *  Given a ScanCache, only the windows that overlap a changed block are
+ *  scanned, the detections of the other ones are carried over from the
+ *  previous frame. Separate changed regions are scanned separately, so two
+ *  small changes far apart do not rescan everything between them.
+ */
+class FaceDetector {
+
+public:
+    typedef dlib::frontal_face_detector::image_scanner_type scanner_type;
+    typedef scanner_type::pyramid_type pyramid_type;
+
+    explicit FaceDetector(const dlib::frontal_face_detector& detector);
+
+    /** Reads what serialize() wrote, filters included, so that nothing is
+     *  built again. Throws dlib::serialization_error on any other content.
+     */
+    explicit FaceDetector(std::istream& in);
+
+    /** Writes the detector with its filters ready to use.
+     */
+    void serialize(std::ostream& out) const;
+
+    /** True when the file starts like what serialize() writes.
+     */
+    static bool isPrebuilt(const std::string& path);
+
+    /** Detects faces in a BGR image, highest confidence first (largest first
+     *  when ranked by area). With default options the result is the one of
+     *  the wrapped frontal_face_detector.
+     */
+    std::vector<dlib::rect_detection> operator()(const cv::Mat& image, dlib::thread_pool& pool,
+        const DetectionOptions& options = DetectionOptions(), ScanCache* cache = 0) const;
+
+private:
+    /** One pyramid level. Detections are mapped back to the input image by
+     *  undoing pyr_steps pyramid_down steps and then scaling by sx, sy.
+     */
+    struct Level {
+        cv::Mat image;
+        unsigned long pyr_steps;
+        double sx;
+        double sy;
+    };
+
+    /** A rectangle of one pyramid level scanned as a single task. Only the
+     *  detections whose top left corner falls into core are kept, area adds
+     *  the margin needed to compute their HOG features exactly.
+     */
+    struct Tile {
+        dlib::rectangle area;
+        dlib::rectangle core;
+    };
+
+    // Per call state, defined in the source file
+    struct Scan;
+
+    void buildPyramid(const cv::Mat& image, const DetectionOptions& options,
+                      std::vector<Level>& levels,
+                      dlib::array<dlib::array2d<dlib::bgr_pixel> >& downsampled) const;
+
+    dlib::rectangle toImage(const Level& level, const dlib::rectangle& rect) const;
+
+    void tileLevel(long nc, long nr, std::vector<Tile>& tiles) const;
+
+    void motionCores(const cv::Mat& image, const Level& level, const cv::Mat& changed,
+                     const std::vector<cv::Rect>& regions, std::vector<dlib::rectangle>& cores) const;
+
+    void motionTiles(const std::vector<Tile>& tiles, const std::vector<dlib::rectangle>& cores,
+                     std::vector<Tile>& motion_tiles) const;
+
+    std::vector<dlib::rect_detection> scanPyramid(Scan& scan, unsigned long mask,
+        const DetectionOptions& options, dlib::thread_pool& pool,
+        std::vector<dlib::rect_detection>& dets) const;
+
+    void scanLevels(Scan& scan, unsigned long begin, unsigned long end,
+                    unsigned long mask, dlib::thread_pool& pool,
+                    std::vector<dlib::rect_detection>& dets) const;
+
+    void scanTile(const Level& level, const Tile& tile,
+                  std::unique_ptr<scanner_type>& tile_scanner,
+                  unsigned long mask, std::vector<dlib::rect_detection>& dets) const;
+
+    std::vector<dlib::rect_detection> suppress(std::vector<dlib::rect_detection>& dets) const;
+
+    void keepBest(std::vector<dlib::rect_detection>& dets, const DetectionOptions& options) const;
+
+    // Only holds the configuration, every task loads its own copy.
+    scanner_type scanner;
+
+    std::vector<scanner_type::fhog_filterbank> filterbanks;
+    std::vector<double> thresholds;
+
+    dlib::test_box_overlap overlap_tester;
+};
+
+#endif // __FACE_DETECTOR
@@ -0,0 +1,78 @@
+#include "face_tracker.hpp"
+
+#include <algorithm>
+
+namespace {
+    double iou(const dlib::rectangle& a, const dlib::rectangle& b) {
+        const double inter = a.intersect(b).area();
+        const double total = a.area() + b.area() - inter;
+        return total > 0 ? inter / total : 0;
+    }
+}
+
+FaceTracker::FaceTracker(double min_iou, int max_missed) :
+    min_iou(min_iou), max_missed(max_missed), next_id(0) {
+}
+
+void FaceTracker::update(const std::vector<dlib::rectangle>& faces, long long timestamp,
+                         std::vector<size_t>& track_of) {
+    matches.clear();
+    for (size_t t = 0; t < tracks_.size(); t++) {
+        for (size_t f = 0; f < faces.size(); f++) {
+            const double overlap = iou(tracks_[t].rect, faces[f]);
+            if (overlap >= min_iou) {
+                Match match = { overlap, t, f };
+                matches.push_back(match);
+            }
+        }
+    }
+    // Ties keep the order they were found in, as a stable sort would, without
+    // its temporary buffer
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+        if (a.iou != b.iou) return a.iou > b.iou;
+        return a.track != b.track ? a.track < b.track : a.face < b.face;
+    });
+
+    const size_t unassigned = (size_t)-1;
+    track_of.assign(faces.size(), unassigned);
+    track_used.assign(tracks_.size(), false);
+    for (auto match : matches) {
+        if (track_used[match.track] || track_of[match.face] != unassigned) continue;
+        track_used[match.track] = true;
+        track_of[match.face] = match.track;
+    }
+
+    // Age the tracks nobody matched, forget the stale ones. The kept tracks
+    // are swapped down in place, their landmarks are never copied.
+    new_index.assign(tracks_.size(), unassigned);
+    size_t kept = 0;
+    for (size_t t = 0; t < tracks_.size(); t++) {
+        if (track_used[t]) {
+            tracks_[t].missed = 0;
+        } else if (++tracks_[t].missed > max_missed) {
+            continue;
+        }
+        if (kept != t) std::swap(tracks_[kept], tracks_[t]);
+        new_index[t] = kept++;
+    }
+    tracks_.resize(kept);
+
+    for (size_t f = 0; f < faces.size(); f++) {
+        if (track_of[f] != unassigned) {
+            track_of[f] = new_index[track_of[f]];
+        } else {
+            FaceTrack track;
+            track.id = next_id++;
+            track.has_pose = false;
+            track.first_seen = timestamp;
+            track.pose_time = 0;
+            track.missed = 0;
+            track_of[f] = tracks_.size();
+            tracks_.push_back(track);
+        }
+
+        FaceTrack& track = tracks_[track_of[f]];
+        track.rect = faces[f];
+        track.last_seen = timestamp;
+    }
+}
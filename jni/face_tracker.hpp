@@ -0,0 +1,73 @@
+#ifndef __FACE_TRACKER
+#define __FACE_TRACKER
+
+#include <opencv2/core/core.hpp>
+#include <dlib/image_processing.h>
+
+#include <vector>
+
+/** What is known about one person across frames.
+ */
+struct FaceTrack {
+    // Stable while the face keeps being detected
+    int id;
+
+    // Last detection and landmarks
+    dlib::rectangle rect;
+    dlib::full_object_detection shape;
+
+    // Last solved pose, valid when has_pose is set
+    bool has_pose;
+    cv::Vec3d rvec;
+    cv::Vec3d tvec;
+
+    // Milliseconds, on the clock passed to FaceTracker::update()
+    long long first_seen;
+    long long last_seen;
+    long long pose_time;
+
+    // Consecutive frames without a matching detection
+    int missed;
+};
+
+/** Associates the detections of consecutive frames by bounding box overlap
+ *  and gives every person a stable id.
+ */
+class FaceTracker {
+
+public:
+    FaceTracker(double min_iou = 0.3, int max_missed = 5);
+
+    /** Matches faces to the current tracks, greedily by decreasing overlap,
+     *  and starts new tracks for the faces left over. Tracks missed for more
+     *  than max_missed frames are dropped. track_of gets, for every face, the
+     *  index of its track in tracks().
+     *
+     *  Tracks are updated in place and the buffers kept from frame to frame,
+     *  so that only a new face allocates.
+     */
+    void update(const std::vector<dlib::rectangle>& faces, long long timestamp, std::vector<size_t>& track_of);
+
+    inline std::vector<FaceTrack>& tracks() { return tracks_; }
+    inline const std::vector<FaceTrack>& tracks() const { return tracks_; }
+
+private:
+    struct Match {
+        double iou;
+        size_t track;
+        size_t face;
+    };
+
+    double min_iou;
+    int max_missed;
+
+    int next_id;
+    std::vector<FaceTrack> tracks_;
+
+    // Per frame scratch buffers
+    std::vector<Match> matches;
+    std::vector<bool> track_used;
+    std::vector<size_t> new_index;
+};
+
+#endif // __FACE_TRACKER
@@ -0,0 +1,47 @@
+#include "frame_signature.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+    // Side of each patch, averaging keeps sensor noise out of the comparison
+    const int PATCH_SIZE = 4;
+}
+
+FrameSignature::FrameSignature() : valid(false) {
+}
+
+void FrameSignature::compute(const cv::Mat& image) {
+    image_size = image.size();
+    valid = !image.empty();
+    if (!valid) return;
+
+    const int patch_cols = std::min(PATCH_SIZE, image.cols);
+    const int patch_rows = std::min(PATCH_SIZE, image.rows);
+    for (int gy = 0; gy < GRID_ROWS; gy++) {
+        const int y0 = (image.rows - patch_rows) * (2 * gy + 1) / (2 * GRID_ROWS);
+        for (int gx = 0; gx < GRID_COLS; gx++) {
+            const int x0 = (image.cols - patch_cols) * (2 * gx + 1) / (2 * GRID_COLS);
+
+            unsigned int sum = 0;
+            for (int y = y0; y < y0 + patch_rows; y++) {
+                const unsigned char* p = image.ptr<unsigned char>(y) + 3 * x0;
+                for (int x = 0; x < patch_cols; x++, p += 3) {
+                    // BT.601 luma in fixed point, pixels are BGR
+                    sum += (29 * p[0] + 150 * p[1] + 77 * p[2]) >> 8;
+                }
+            }
+            values[gy * GRID_COLS + gx] = sum / (patch_cols * patch_rows);
+        }
+    }
+}
+
+bool FrameSignature::matches(const FrameSignature& other, int tolerance) const {
+    if (!valid || !other.valid || image_size != other.image_size)
+        return false;
+
+    for (int i = 0; i < GRID_COLS * GRID_ROWS; i++) {
+        if (std::abs((int)values[i] - (int)other.values[i]) > tolerance) return false;
+    }
+    return true;
+}
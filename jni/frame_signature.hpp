@@ -0,0 +1,33 @@
+#ifndef __FRAME_SIGNATURE
+#define __FRAME_SIGNATURE
+
+#include <opencv2/core/core.hpp>
+
+/** Cheap fingerprint of a BGR frame: the mean luminance of small patches
+ *  sampled on a fixed grid. Two frames whose fingerprints are within a few
+ *  grey levels of each other are treated as the same picture.
+ */
+class FrameSignature {
+
+public:
+    FrameSignature();
+
+    void compute(const cv::Mat& image);
+
+    /** True when both frames have the same size and no sampled patch differs
+     *  by more than tolerance grey levels.
+     */
+    bool matches(const FrameSignature& other, int tolerance) const;
+
+private:
+    // Patches sampled across and down the frame
+    static const int GRID_COLS = 32;
+    static const int GRID_ROWS = 24;
+
+    cv::Size image_size;
+    // Fixed size, so that computing and copying a signature never allocates
+    unsigned char values[GRID_COLS * GRID_ROWS];
+    bool valid;
+};
+
+#endif // __FRAME_SIGNATURE
@@ -0,0 +1,21 @@
+#include "head_model.hpp"
+
+// Storage of the model tables, indexed at run time
+constexpr float PoseModel<MODE_ITERATIVE>::points[PoseModel<MODE_ITERATIVE>::SIZE][3];
+constexpr int PoseModel<MODE_ITERATIVE>::landmarks[PoseModel<MODE_ITERATIVE>::SIZE][2];
+constexpr float PoseModel<MODE_P3P>::points[PoseModel<MODE_P3P>::SIZE][3];
+constexpr int PoseModel<MODE_P3P>::landmarks[PoseModel<MODE_P3P>::SIZE][2];
+constexpr float PoseModel<MODE_FIVE_POINT>::points[PoseModel<MODE_FIVE_POINT>::SIZE][3];
+constexpr int PoseModel<MODE_FIVE_POINT>::landmarks[PoseModel<MODE_FIVE_POINT>::SIZE][2];
+
+std::vector<unsigned long> poseLandmarks() {
+    std::vector<unsigned long> landmarks;
+    for (int i = 0; i < PoseModel<MODE_ITERATIVE>::SIZE; i++) {
+        landmarks.push_back(PoseModel<MODE_ITERATIVE>::landmarks[i][0]);
+        landmarks.push_back(PoseModel<MODE_ITERATIVE>::landmarks[i][1]);
+    }
+    for (int i = 0; i < PoseModel<MODE_P3P>::SIZE; i++) {
+        landmarks.push_back(PoseModel<MODE_P3P>::landmarks[i][0]);
+    }
+    return landmarks;
+}
@@ -0,0 +1,139 @@
+#ifndef __HEAD_MODEL
+#define __HEAD_MODEL
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+// Interesting facial features with their landmark index
+enum FACIAL_FEATURE {
+    NOSE=30,
+    RIGHT_EYE=36,
+    LEFT_EYE=45,
+    RIGHT_SIDE=0,
+    LEFT_SIDE=16,
+    EYEBROW_RIGHT=21,
+    EYEBROW_LEFT=22,
+    MOUTH_UP=51,
+    MOUTH_DOWN=57,
+    MOUTH_RIGHT=48,
+    MOUTH_LEFT=54,
+    SELLION=27,
+    MOUTH_CENTER_TOP=62,
+    MOUTH_CENTER_BOTTOM=66,
+    MENTON=8
+};
+
+// 8 point head model, refined by HeadPoseSolver from the last pose or a fixed guess
+const static int MODE_ITERATIVE = 0;
+const static int MODE_P3P = 1;
+const static int MODE_EPNP = 2;
+// As MODE_ITERATIVE, a new face starting from a closed-form pose instead
+const static int MODE_GAUSS_NEWTON = 3;
+// Eye corners and nose of dlib's shape_predictor_5_face_landmarks.dat, by HeadPoseSolver
+const static int MODE_FIVE_POINT = 4;
+
+// Landmark index of the features of the 5 point model
+enum FIVE_POINT_FEATURE {
+    FIVE_LEFT_EYE_OUTER=0,
+    FIVE_LEFT_EYE_INNER=1,
+    FIVE_RIGHT_EYE_OUTER=2,
+    FIVE_RIGHT_EYE_INNER=3,
+    FIVE_SUBNASALE=4
+};
+
+/** 3D points and landmarks of the model a pose mode solves for, the one
+ *  source of the head geometry. Points are in millimetres in the head frame:
+ *  origin at the sellion, x forward, y to the left, z up. Each point projects onto the mean of its two landmarks, the
+ *  same landmark twice where the face has one.
+ */
+template <int Mode> struct PoseModel;
+
+template <> struct PoseModel<MODE_ITERATIVE> {
+    static constexpr int SIZE = 8;
+    static constexpr float points[SIZE][3] = {
+        {0., 0., 0.},           // sellion
+        {-20., -65.5, -5.},     // right eye
+        {-20., 65.5, -5.},      // left eye
+        {-100., -77.5, -6.},    // right ear
+        {-100., 77.5, -6.},     // left ear
+        {0., 0., -133.0},       // menton
+        {21.0, 0., -48.0},      // nose
+        {10.0, 0., -75.0}       // stommion
+    };
+    static constexpr int landmarks[SIZE][2] = {
+        {SELLION, SELLION},
+        {RIGHT_EYE, RIGHT_EYE},
+        {LEFT_EYE, LEFT_EYE},
+        {RIGHT_SIDE, RIGHT_SIDE},
+        {LEFT_SIDE, LEFT_SIDE},
+        {MENTON, MENTON},
+        {NOSE, NOSE},
+        // Stommion is the mean point between upper and lower lip, there's not such landmark
+        {MOUTH_CENTER_TOP, MOUTH_CENTER_BOTTOM}
+    };
+};
+
+template <> struct PoseModel<MODE_P3P> {
+    static constexpr int SIZE = 4;
+    static constexpr float points[SIZE][3] = {
+        {21.0, 0., -48.0},      // nose
+        {-100., -77.5, -6.},    // right ear
+        {-100., 77.5, -6.},     // left ear
+        {0., 0., -133.0}        // menton
+    };
+    static constexpr int landmarks[SIZE][2] = {
+        {NOSE, NOSE},
+        {RIGHT_SIDE, RIGHT_SIDE},
+        {LEFT_SIDE, LEFT_SIDE},
+        {MENTON, MENTON}
+    };
+};
+
+template <> struct PoseModel<MODE_FIVE_POINT> {
+    static constexpr int SIZE = 5;
+    static constexpr float points[SIZE][3] = {
+        {-20., -65.5, -5.},     // right eye
+        {-15., -22., -5.},      // right eye inner corner
+        {-15., 22., -5.},       // left eye inner corner
+        {-20., 65.5, -5.},      // left eye
+        {7.0, 0., -58.0}        // subnasale
+    };
+    static constexpr int landmarks[SIZE][2] = {
+        {FIVE_RIGHT_EYE_OUTER, FIVE_RIGHT_EYE_OUTER},
+        {FIVE_RIGHT_EYE_INNER, FIVE_RIGHT_EYE_INNER},
+        {FIVE_LEFT_EYE_INNER, FIVE_LEFT_EYE_INNER},
+        {FIVE_LEFT_EYE_OUTER, FIVE_LEFT_EYE_OUTER},
+        {FIVE_SUBNASALE, FIVE_SUBNASALE}
+    };
+};
+
+template <> struct PoseModel<MODE_EPNP> : PoseModel<MODE_ITERATIVE> {};
+template <> struct PoseModel<MODE_GAUSS_NEWTON> : PoseModel<MODE_ITERATIVE> {};
+
+/** Landmarks of the 68 point model that the pose modes read.
+ */
+std::vector<unsigned long> poseLandmarks();
+
+typedef cv::Matx44d head_pose;
+
+/** Pose of one face, as returned by HeadPoseEstimation::estimatePose().
+ */
+struct FacePose {
+    // Bring the head model (mm) into the camera frame, rvec as in Rodrigues()
+    cv::Vec3d rvec;
+    cv::Vec3d tvec;
+    cv::Matx33d rotation;
+    // Same rotation as a unit quaternion (w, x, y, z)
+    cv::Vec4d quaternion;
+
+    // Camera position in the head frame (mm), from the rigid inverse of the pose
+    cv::Vec3d camera;
+
+    // Head orientation as seen from the camera, in radians
+    double yaw;
+    double pitch;
+    double roll;
+};
+
+#endif // __HEAD_MODEL
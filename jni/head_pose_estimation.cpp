@@ -1,6 +1,14 @@
 #include "head_pose_estimation.hpp"
 #include <opencv2/calib3d/calib3d.hpp>
 
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+
 using namespace dlib;
 using namespace std;
 using namespace cv;
@@ -9,14 +17,139 @@ inline Point2f toCv(const dlib::point& p) {
     return Point2f(p.x(), p.y());
 }
 
+/** Milliseconds on a monotonic clock, used to timestamp the face tracks.
+ */
+inline long long nowMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** The model of a pose mode, for its HeadPoseSolver.
+ */
+template <int Mode>
+static typename HeadPoseSolver<PoseModel<Mode>::SIZE>::model_type solverModel() {
+    typedef PoseModel<Mode> Model;
+    typename HeadPoseSolver<Model::SIZE>::model_type model;
+    for (int i = 0; i < Model::SIZE; i++) {
+        for (int j = 0; j < 3; j++) model(i,j) = Model::points[i][j];
+    }
+    return model;
+}
+
+/** Undoes lens distortion (k1, k2, p1, p2, k3) on one image point by fixed
+ *  point iteration, as cv::undistortPoints does, without its allocations.
+ */
+static Point2d undistortPoint(const Point2f& point, double fx, double fy, double cx, double cy,
+                              const Mat1f& dist) {
+    const double k1 = dist(0), k2 = dist(1), p1 = dist(2), p2 = dist(3), k3 = dist(4);
+    const double x0 = (point.x - cx) / fx, y0 = (point.y - cy) / fy;
+    double x = x0, y = y0;
+    for (int i = 0; i < 5; i++) {
+        const double r2 = x * x + y * y;
+        const double icdist = 1 / (1 + ((k3 * r2 + k2) * r2 + k1) * r2);
+        const double dx = 2 * p1 * x * y + p2 * (r2 + 2 * x * x);
+        const double dy = p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;
+        x = (x0 - dx) * icdist;
+        y = (y0 - dy) * icdist;
+    }
+    return Point2d(x * fx + cx, y * fy + cy);
+}
+
+/** Orientation of the head as seen from the camera. These are the YPR Euler
+ *  angles of the inverse rotation (its transpose), as tf::Matrix3x3::getRPY
+ *  gives them, turned to the head's axes.
+ */
+static void headAngles(const Matx33d& rotation, double& yaw, double& pitch, double& roll) {
+    // Element (i,j) of the inverse is rotation(j,i)
+    double raw_yaw, raw_pitch, raw_roll;
+    if (std::abs(rotation(0,2)) >= 1) {
+        // Pitch at a singularity
+        raw_yaw = 0;
+        if (rotation(0,2) < 0) {
+            raw_pitch = M_PI / 2;
+            raw_roll = atan2(rotation(1,0), rotation(2,0));
+        } else {
+            raw_pitch = -M_PI / 2;
+            raw_roll = atan2(-rotation(1,0), -rotation(2,0));
+        }
+    } else {
+        raw_pitch = -asin(rotation(0,2));
+        const double c = cos(raw_pitch);
+        raw_roll = atan2(rotation(1,2) / c, rotation(2,2) / c);
+        raw_yaw = atan2(rotation(0,1) / c, rotation(0,0) / c);
+    }
+
+    roll = raw_pitch;
+    yaw = raw_yaw + M_PI / 2;
+    pitch = -(raw_roll - M_PI / 2);
+}
+
+/** The 4x4 transform of a pose, translation in meters.
+ */
+static head_pose toHeadPose(const FacePose& face_pose) {
+    const Matx33d& r = face_pose.rotation;
+    const Vec3d& t = face_pose.tvec;
+    head_pose pose = {
+        r(0,0),    r(0,1),    r(0,2),    t[0]/1000,
+        r(1,0),    r(1,1),    r(1,2),    t[1]/1000,
+        r(2,0),    r(2,1),    r(2,2),    t[2]/1000,
+             0,         0,         0,            1
+    };
+    return pose;
+}
+
 HeadPoseEstimation::HeadPoseEstimation(const string& face_detection_model, int mod, 
     float fx, float fy, float cx, float cy, 
-    float k1, float k2, float p1, float p2, float k3) {
-    // Load face detection and pose estimation models.
-    detector = get_frontal_face_detector();
-    deserialize(face_detection_model) >> pose_model;
+    float k1, float k2, float p1, float p2, float k3,
+    int min_face_size, int max_face_size, float pyramid_step, int landmark_pruning,
+    const string& face_detector_model) :
+    detector(ModelRegistry::instance().faceDetector(face_detector_model)),
+    // MODE_FIVE_POINT needs the landmarks pruning drops
+    landmarkModel(ModelRegistry::instance().landmarkModel(face_detection_model,
+        mod == MODE_FIVE_POINT ? PRUNE_NONE : landmark_pruning)),
+    cascadeDepth(ULONG_MAX),
+    pool(ModelRegistry::instance().threadPool()),
+    warmStart(true),
+    poseCriteria(TermCriteria::COUNT + TermCriteria::EPS, 20, FLT_EPSILON),
+    headSolver(solverModel<MODE_GAUSS_NEWTON>()),
+    fivePointSolver(solverModel<MODE_FIVE_POINT>()),
+    duplicateTolerance(-1),
+    posesValid(false) {
+    // Pruned models have their own landmark numbering, ULONG_MAX for the
+    // landmarks they dropped
+    const std::vector<unsigned long>& kept = landmarkModel->landmarks;
+    for (size_t i = 0; i < kept.size(); i++) {
+        if (kept[i] != i) {
+            landmarkParts.assign(68, ULONG_MAX);
+            for (size_t j = 0; j < kept.size(); j++) landmarkParts[kept[j]] = j;
+            LOG(INFO) << "Pruned landmark model keeps " << kept.size() << " of 68 landmarks";
+            break;
+        }
+    }
+    // A model pruned offline for another list may lack a landmark the pose
+    // modes read, which would otherwise silently read another one
+    if (!landmarkParts.empty()) {
+        for (unsigned long landmark : poseLandmarks()) {
+            if (landmarkParts[landmark] == ULONG_MAX) {
+                std::ostringstream message;
+                message << "Pruned landmark model without landmark " << landmark << " of the pose modes.";
+                throw dlib::serialization_error(message.str());
+            }
+        }
+    }
+    const unsigned long num_parts = landmarkModel->num_parts();
     mode = mod; // Set correct mode
 
+    // The 5 point model only has the landmarks of MODE_FIVE_POINT, the other
+    // modes need the 68 point one
+    if (num_parts == 5 && mode != MODE_FIVE_POINT) {
+        LOG(WARNING) << "5 point landmark model, using MODE_FIVE_POINT instead of mode " << mode;
+        mode = MODE_FIVE_POINT;
+    } else if (num_parts != 5 && mode == MODE_FIVE_POINT) {
+        LOG(WARNING) << num_parts << " point landmark model, using MODE_GAUSS_NEWTON instead of MODE_FIVE_POINT";
+        mode = MODE_GAUSS_NEWTON;
+    }
+
     // Set cameraMatrix
     cv::Mat m = cv::Mat::zeros(3,3,CV_32F);
     cameraMatrix = m;
@@ -31,6 +164,13 @@ HeadPoseEstimation::HeadPoseEstimation(const string& face_detection_model, int m
 
     distCoeffs = (Mat1d(1, 5) << k1, k2, p1, p2, k3);
     LOG(INFO) << "Initialized Default Camera Distortion Matrix with:\n{k1} = " << k1 << " {k2} = " << k2 << " {p1} = " << p1  << " {p2} = " << p2<< " {k3} = " << k3;
+
+    // Set detector pyramid, zeros keep dlib's defaults
+    detectionOptions.min_face_size = min_face_size;
+    detectionOptions.max_face_size = max_face_size;
+    detectionOptions.pyramid_step = pyramid_step;
+    LOG(INFO) << "Initialized Detector Pyramid with:\n{min_face_size} = " << min_face_size
+            << " {max_face_size} = " << max_face_size << " {pyramid_step} = " << pyramid_step;
 }
 
 int HeadPoseEstimation::detect(cv::Mat& image) {
@@ -54,62 +194,191 @@ int HeadPoseEstimation::detect(cv::Mat& image) {
     // Check that the image is valid
     if (image.empty()) return 0;
 
+    // A near duplicate of the last processed frame keeps its faces, shapes,
+    // poses and resultMat, unless rendering was turned on since and there is
+    // no resultMat to keep
+    if (duplicateTolerance >= 0) {
+        FrameSignature signature;
+        signature.compute(image);
+        if (signature.matches(lastSignature, duplicateTolerance) && (!renderer.enabled || !resultMat.empty()))
+            return faces.size();
+        lastSignature = signature;
+    }
+    posesValid = false;
+
     // Set as current image
     current_image = dlib::cv_image<dlib::bgr_pixel>(image);
-    // Perform detection
-    faces = detector(current_image);
-    // Put the results into a collection, and update how many found
-    shapes.clear();
-    int count = 0;
-    for (auto face : faces){
-        shapes.push_back(pose_model(current_image, face));
-        count++;
+    // Perform detection, spread over the thread pool, only where the image
+    // changed when motion guidance is on
+    std::vector<rect_detection> dets;
+    if (motionMask.enabled()) {
+        motionMask.update(image, scanCache.changed);
+        dets = (*detector)(image, *pool, detectionOptions, &scanCache);
+    } else {
+        dets = (*detector)(image, *pool, detectionOptions);
+    }
+    faces.clear();
+    for (auto det : dets)
+        faces.push_back(det.rect);
+    // Put the results into a collection, one landmark prediction per face
+    // on the pool, and update how many found
+    shapes.resize(faces.size());
+    parallel_for(*pool, 0, faces.size(), [&](long i) {
+        shapes[i] = predictLandmarks(faces[i]);
+    });
+    int count = faces.size();
+
+    // Follow the faces across frames
+    tracker.update(faces, nowMillis(), faceTracks);
+    for (size_t i = 0; i < faces.size(); i++) {
+        tracker.tracks()[faceTracks[i]].shape = shapes[i];
+    }
+
+    // Nothing to draw on when rendering is off, rather than a stale frame
+    if (!renderer.enabled) {
+        resultMat.release();
+        return count;
     }
 
     // Get a clone to draw on
     resultMat = image.clone();
 
     // Draw lines for landmarks
-    auto color = Scalar(0,255,0);
     for (unsigned long i = 0; i < shapes.size(); ++i)
-    {
-        const full_object_detection& d = shapes[i];
-
-        for (unsigned long i = 1; i <= 16; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-
-        for (unsigned long i = 28; i <= 30; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-
-        for (unsigned long i = 18; i <= 21; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        for (unsigned long i = 23; i <= 26; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        for (unsigned long i = 31; i <= 35; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        line(resultMat, toCv(d.part(30)), toCv(d.part(35)), color, 2, CV_AA);
-
-        for (unsigned long i = 37; i <= 41; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        line(resultMat, toCv(d.part(36)), toCv(d.part(41)), color, 2, CV_AA);
-
-        for (unsigned long i = 43; i <= 47; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        line(resultMat, toCv(d.part(42)), toCv(d.part(47)), color, 2, CV_AA);
-
-        for (unsigned long i = 49; i <= 59; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        line(resultMat, toCv(d.part(48)), toCv(d.part(59)), color, 2, CV_AA);
-
-        for (unsigned long i = 61; i <= 67; ++i)
-            line(resultMat, toCv(d.part(i)), toCv(d.part(i-1)), color, 2, CV_AA);
-        line(resultMat, toCv(d.part(60)), toCv(d.part(67)), color, 2, CV_AA);
-    }
+        renderer.drawLandmarks(resultMat, shapes[i]);
 
     return count;
 }
 
+full_object_detection HeadPoseEstimation::predictLandmarks(const dlib::rectangle& face) const {
+    const CompactShapePredictor& engine = landmarkModel->compact.empty() ? forestEngine : landmarkModel->compact;
+    return engine.empty() ? landmarkModel->predictor(current_image, face)
+                          : engine(current_image, face, cascadeDepth);
+}
+
+void HeadPoseEstimation::warmup(int width, int height) {
+    LOG(INFO) << "Warming up for " << width << "x" << height << " frames";
+    if (width <= 0 || height <= 0) return;
+    landmarkModel->compact.prefault();
+    forestEngine.prefault();
+
+    // The tracks, and the next id to give, as they were before the synthetic frame
+    const FaceTracker tracks = tracker;
+
+    // Detection on noise, taken as a new frame whatever the last one was
+    Mat frame(height, width, CV_8UC3);
+    randu(frame, Scalar::all(0), Scalar::all(256));
+    const int tolerance = duplicateTolerance;
+    duplicateTolerance = -1;
+    detect(frame);
+    duplicateTolerance = tolerance;
+
+    // Noise rarely holds a face, so landmarks and pose go through one in the
+    // middle of the frame
+    const long side = std::min(width, height) / 2;
+    faces.assign(1, centered_rect(dlib::point(width / 2, height / 2), side, side));
+    shapes.assign(1, predictLandmarks(faces[0]));
+    tracker.update(faces, nowMillis(), faceTracks);
+    tracker.tracks()[faceTracks[0]].shape = shapes[0];
+    posesValid = false;
+    solvePoses();
+
+    // Leave nothing of the synthetic frame
+    faces.clear();
+    shapes.clear();
+    faceTracks.clear();
+    tracker = tracks;
+    motionMask.reset();
+    scanCache = ScanCache();
+    lastSignature = FrameSignature();
+    cachedPoses.clear();
+    cachedFacePoses.clear();
+    posesValid = false;
+    resultMat = Mat();
+    current_image = dlib::cv_image<dlib::bgr_pixel>();
+}
+
+void HeadPoseEstimation::setDuplicateTolerance(int tolerance) {
+    LOG(INFO) << "Duplicate frame tolerance " << tolerance;
+    duplicateTolerance = tolerance;
+    lastSignature = FrameSignature();
+}
+
+void HeadPoseEstimation::setMotionGuidance(int threshold, int refresh_interval) {
+    LOG(INFO) << "Motion guidance with threshold " << threshold << " and refresh interval " << refresh_interval;
+    motionMask.configure(threshold, refresh_interval);
+}
+
 head_pose HeadPoseEstimation::pose(size_t face_idx) const {
+    const FacePose face_pose = estimatePose(face_idx);
+    if (renderer.enabled) renderer.drawPose(resultMat, face_pose, mode, cameraMatrix);
+    return toHeadPose(face_pose);
+}
+
+/** The points of the model of Mode, and where the face shows them. Both
+ *  live on the caller's stack, sized by the model table.
+ */
+template <int Mode>
+void HeadPoseEstimation::gatherPoints(size_t face_idx, Point3f (&head_points)[PoseModel<Mode>::SIZE],
+                                      Point2f (&detected_points)[PoseModel<Mode>::SIZE]) const {
+    typedef PoseModel<Mode> Model;
+    for (int i = 0; i < Model::SIZE; i++) {
+        head_points[i] = Point3f(Model::points[i][0], Model::points[i][1], Model::points[i][2]);
+        detected_points[i] = (coordsOf(face_idx, (FACIAL_FEATURE) Model::landmarks[i][0]) +
+                              coordsOf(face_idx, (FACIAL_FEATURE) Model::landmarks[i][1])) * 0.5;
+    }
+}
+
+/** Solves for the model of Mode, starting from rvec and tvec.
+ */
+template <int Mode>
+void HeadPoseEstimation::solveMode(size_t face_idx, Vec3d& rvec, Vec3d& tvec) const {
+    // Lists of 3D points and of the matching 2D points
+    Point3f head_points[PoseModel<Mode>::SIZE];
+    Point2f detected_points[PoseModel<Mode>::SIZE];
+    gatherPoints<Mode>(face_idx, head_points, detected_points);
+
+    solvePnP(Mat(PoseModel<Mode>::SIZE, 1, CV_32FC3, head_points),
+        Mat(PoseModel<Mode>::SIZE, 1, CV_32FC2, detected_points),
+        cameraMatrix, distCoeffs,
+        rvec, tvec, true, Mode == MODE_P3P ? SOLVEPNP_P3P : SOLVEPNP_EPNP);
+}
+
+/** Solves for the model of Mode with its dedicated solver, starting from
+ *  rvec and tvec when the face has a previous pose.
+ *
+ *  MODE_ITERATIVE otherwise starts from the fixed guess in rvec and tvec, as
+ *  solvePnP(..., true, SOLVEPNP_ITERATIVE) did; the other modes from the
+ *  closed-form scaled orthographic pose, which takes far fewer iterations.
+ */
+template <int Mode>
+void HeadPoseEstimation::solveDedicated(size_t face_idx, const HeadPoseSolver<PoseModel<Mode>::SIZE>& solver,
+                                        Vec3d& rvec, Vec3d& tvec) const {
+    Point3f head_points[PoseModel<Mode>::SIZE];
+    Point2f detected_points[PoseModel<Mode>::SIZE];
+    gatherPoints<Mode>(face_idx, head_points, detected_points);
+
+    const FaceTrack& last = track(face_idx);
+    const bool estimate = Mode != MODE_ITERATIVE && !(warmStart && last.has_pose);
+    solveGaussNewton(solver, detected_points, estimate, rvec, tvec);
+}
+
+template <>
+void HeadPoseEstimation::solveMode<MODE_ITERATIVE>(size_t face_idx, Vec3d& rvec, Vec3d& tvec) const {
+    solveDedicated<MODE_ITERATIVE>(face_idx, headSolver, rvec, tvec);
+}
+
+template <>
+void HeadPoseEstimation::solveMode<MODE_GAUSS_NEWTON>(size_t face_idx, Vec3d& rvec, Vec3d& tvec) const {
+    solveDedicated<MODE_GAUSS_NEWTON>(face_idx, headSolver, rvec, tvec);
+}
+
+template <>
+void HeadPoseEstimation::solveMode<MODE_FIVE_POINT>(size_t face_idx, Vec3d& rvec, Vec3d& tvec) const {
+    solveDedicated<MODE_FIVE_POINT>(face_idx, fivePointSolver, rvec, tvec);
+}
+
+FacePose HeadPoseEstimation::estimatePose(size_t face_idx) const {
 
     /*
         solvePnP
@@ -137,136 +406,209 @@ head_pose HeadPoseEstimation::pose(size_t face_idx) const {
         The function estimates the object pose given a set of object points, their corresponding image projections, as well as the camera matrix and the distortion coefficients.
     */
 
-    std::vector<Point3f> head_points;
-    std::vector<Point2f> detected_points;
-
     // Initializing the head pose 1m away, roughly facing the robot
     // This initialization is important as it prevents solvePnP to find the
     // mirror solution (head *behind* the camera)
-    Mat tvec = (Mat_<double>(3,1) << 0., 0., 1000.);
-    Mat rvec = (Mat_<double>(3,1) << 1.2, 1.2, -1.2);
-
-    if(mode == MODE_ITERATIVE) {
-        // List of 3D points
-        head_points.push_back(P3D_SELLION);
-        head_points.push_back(P3D_RIGHT_EYE);
-        head_points.push_back(P3D_LEFT_EYE);
-        head_points.push_back(P3D_RIGHT_EAR);
-        head_points.push_back(P3D_LEFT_EAR);
-        head_points.push_back(P3D_MENTON);
-        head_points.push_back(P3D_NOSE);
-        head_points.push_back(P3D_STOMMION);
-
-        // List of 2D points
-        detected_points.push_back(coordsOf(face_idx, SELLION));
-        detected_points.push_back(coordsOf(face_idx, RIGHT_EYE));
-        detected_points.push_back(coordsOf(face_idx, LEFT_EYE));
-        detected_points.push_back(coordsOf(face_idx, RIGHT_SIDE));
-        detected_points.push_back(coordsOf(face_idx, LEFT_SIDE));
-        detected_points.push_back(coordsOf(face_idx, MENTON));
-        detected_points.push_back(coordsOf(face_idx, NOSE));
-
-        // Stommion is the mean point between upper and lower lip, I must calculate it since there's not such landmark
-        auto stomion = (coordsOf(face_idx, MOUTH_CENTER_TOP) + coordsOf(face_idx, MOUTH_CENTER_BOTTOM)) * 0.5;
-        detected_points.push_back(stomion);
-
-        // Find the 3D pose of our head
-        solvePnP(head_points, detected_points,
-            cameraMatrix, distCoeffs,
-            rvec, tvec, true, SOLVEPNP_ITERATIVE);
-    } else if(mode == MODE_P3P) {
-        // List of 3D points
-        head_points.push_back(P3D_NOSE);
-        head_points.push_back(P3D_RIGHT_EAR);
-        head_points.push_back(P3D_LEFT_EAR);
-        head_points.push_back(P3D_MENTON);
-
-        // List of 2D points
-        detected_points.push_back(coordsOf(face_idx, NOSE));
-        detected_points.push_back(coordsOf(face_idx, RIGHT_SIDE));
-        detected_points.push_back(coordsOf(face_idx, LEFT_SIDE));
-        detected_points.push_back(coordsOf(face_idx, MENTON));
-
-        // Find the 3D pose of our head
-        solvePnP(head_points, detected_points,
-            cameraMatrix, distCoeffs,
-            rvec, tvec, true, SOLVEPNP_P3P);
-    } else if(mode == MODE_EPNP) {
-        // List of 3D points
-        head_points.push_back(P3D_SELLION);
-        head_points.push_back(P3D_RIGHT_EYE);
-        head_points.push_back(P3D_LEFT_EYE);
-        head_points.push_back(P3D_RIGHT_EAR);
-        head_points.push_back(P3D_LEFT_EAR);
-        head_points.push_back(P3D_MENTON);
-        head_points.push_back(P3D_NOSE);
-        head_points.push_back(P3D_STOMMION);
-
-        // List of 2D points
-        detected_points.push_back(coordsOf(face_idx, SELLION));
-        detected_points.push_back(coordsOf(face_idx, RIGHT_EYE));
-        detected_points.push_back(coordsOf(face_idx, LEFT_EYE));
-        detected_points.push_back(coordsOf(face_idx, RIGHT_SIDE));
-        detected_points.push_back(coordsOf(face_idx, LEFT_SIDE));
-        detected_points.push_back(coordsOf(face_idx, MENTON));
-        detected_points.push_back(coordsOf(face_idx, NOSE));
-
-        // Stommion is the mean point between upper and lower lip, I must calculate it since there's not such landmark
-        auto stomion = (coordsOf(face_idx, MOUTH_CENTER_TOP) + coordsOf(face_idx, MOUTH_CENTER_BOTTOM)) * 0.5;
-        detected_points.push_back(stomion);
-
-        // Find the 3D pose of our head
-        solvePnP(head_points, detected_points,
-            cameraMatrix, distCoeffs,
-            rvec, tvec, true, SOLVEPNP_EPNP);
+    Vec3d tvec(0., 0., 1000.);
+    Vec3d rvec(1.2, 1.2, -1.2);
+
+    // Better still, start from where the same face was last frame
+    const FaceTrack& last = track(face_idx);
+    if (warmStart && last.has_pose) {
+        rvec = last.rvec;
+        tvec = last.tvec;
+    }
+
+    // Find the 3D pose of our head
+    switch (mode) {
+    case MODE_ITERATIVE: solveMode<MODE_ITERATIVE>(face_idx, rvec, tvec); break;
+    case MODE_P3P: solveMode<MODE_P3P>(face_idx, rvec, tvec); break;
+    case MODE_EPNP: solveMode<MODE_EPNP>(face_idx, rvec, tvec); break;
+    case MODE_GAUSS_NEWTON: solveMode<MODE_GAUSS_NEWTON>(face_idx, rvec, tvec); break;
+    case MODE_FIVE_POINT: solveMode<MODE_FIVE_POINT>(face_idx, rvec, tvec); break;
+    }
+
+    FacePose pose;
+    pose.rvec = rvec;
+    pose.tvec = tvec;
+    Rodrigues(rvec, pose.rotation);
+
+    // Rigid inverse: the camera sits at -R^T t in the head frame
+    pose.camera = -(pose.rotation.t() * tvec);
+
+    // Unit quaternion straight from the rotation vector, angle |rvec| about rvec
+    const double angle = norm(rvec);
+    if (angle > 0) {
+        const double s = sin(angle / 2) / angle;
+        pose.quaternion = Vec4d(cos(angle / 2), rvec[0] * s, rvec[1] * s, rvec[2] * s);
+    } else {
+        pose.quaternion = Vec4d(1, 0, 0, 0);
+    }
+
+    headAngles(pose.rotation, pose.yaw, pose.pitch, pose.roll);
+    return pose;
+}
+
+/** Refines rvec and tvec with a dedicated solver, after replacing them with
+ *  the solver's closed-form estimate when asked to. Returns the number of
+ *  iterations run.
+ */
+template <int N>
+int HeadPoseEstimation::solveGaussNewton(const HeadPoseSolver<N>& solver, const Point2f (&detected_points)[N],
+                                         bool estimate, Vec3d& rvec, Vec3d& tvec) const {
+    const double fx = cameraMatrix(0,0), fy = cameraMatrix(1,1);
+    const double cx = cameraMatrix(0,2), cy = cameraMatrix(1,2);
+
+    // The solver models a pinhole camera, undistort the points if needed
+    typename HeadPoseSolver<N>::points_type image;
+    const bool distorted = countNonZero(distCoeffs) > 0;
+    for (int i = 0; i < N; i++) {
+        if (distorted) {
+            const Point2d p = undistortPoint(detected_points[i], fx, fy, cx, cy, distCoeffs);
+            image(i,0) = p.x;
+            image(i,1) = p.y;
+        } else {
+            image(i,0) = detected_points[i].x;
+            image(i,1) = detected_points[i].y;
+        }
     }
 
     Matx33d rotation;
     Rodrigues(rvec, rotation);
+    if (estimate) solver.estimate(image, fx, fy, cx, cy, rotation, tvec);
 
-    head_pose pose = {
-        rotation(0,0),    rotation(0,1),    rotation(0,2),    tvec.at<double>(0)/1000,
-        rotation(1,0),    rotation(1,1),    rotation(1,2),    tvec.at<double>(1)/1000,
-        rotation(2,0),    rotation(2,1),    rotation(2,2),    tvec.at<double>(2)/1000,
-                    0,                0,                0,                     1
-    };
+    const int iter = solver.refine(image, fx, fy, cx, cy, rotation, tvec, poseCriteria);
 
-    // Istantiate head_points, reproject them with rvec and tvec, and draw them onto the resultMat
-    std::vector<Point2f> reprojected_points;
-    projectPoints(head_points, rvec, tvec, cameraMatrix, noArray(), reprojected_points);
+    Rodrigues(rotation, rvec);
+    return iter;
+}
+
+void HeadPoseEstimation::setPoseSolver(bool warm_start, int max_iterations, double epsilon) {
+    LOG(INFO) << "Pose solver with warm start " << warm_start << ", at most " << max_iterations
+            << " iterations and epsilon " << epsilon;
+    warmStart = warm_start;
+    poseCriteria = TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, max_iterations, epsilon);
+}
 
-    for (auto point : reprojected_points) {
-        circle(resultMat, point,2, Scalar(0,255,255), 2);
+void HeadPoseEstimation::setForestEngine(bool enabled) {
+    // Nothing to switch when the model only exists in the compact layout
+    if (!landmarkModel->compact.empty()) return;
+    if (enabled && forestEngine.empty()) {
+        std::stringstream model;
+        serialize(landmarkModel->predictor, model);
+        ShapePredictorData data;
+        readShapePredictor(model, data);
+        forestEngine.assign(data, landmarkModel->landmarks);
+        LOG(INFO) << "Forest engine on, " << forestEngine.num_parts() << " landmarks";
+    } else if (!enabled && !forestEngine.empty()) {
+        forestEngine.unload();
+        LOG(INFO) << "Forest engine off";
     }
+}
+
+void HeadPoseEstimation::setCascadeDepth(int levels) {
+    LOG(INFO) << "Cascade depth " << levels;
+    cascadeDepth = levels > 0 ? levels : ULONG_MAX;
+    if (levels > 0) setForestEngine(true);
+}
 
-    // Istantiate axes, reproject them with rvec and tvec, and draw them onto the resultMat
-    std::vector<Point3f> axes;
-    axes.push_back(Point3f(0,0,0));
-    axes.push_back(Point3f(50,0,0));
-    axes.push_back(Point3f(0,50,0));
-    axes.push_back(Point3f(0,0,50));
+const std::vector<head_pose>& HeadPoseEstimation::poses() const {
+    solvePoses();
+    return cachedPoses;
+}
 
-    std::vector<Point2f> projected_axes;
-    projectPoints(axes, rvec, tvec, cameraMatrix, noArray(), projected_axes);
+const std::vector<FacePose>& HeadPoseEstimation::facePoses() const {
+    solvePoses();
+    return cachedFacePoses;
+}
 
-    line(resultMat, projected_axes[0], projected_axes[3], Scalar(255,0,0),2,CV_AA);
-    line(resultMat, projected_axes[0], projected_axes[2], Scalar(0,255,0),2,CV_AA);
-    line(resultMat, projected_axes[0], projected_axes[1], Scalar(0,0,255),2,CV_AA);
+/** Solves, tracks and draws the poses of the current faces, once per frame.
+ */
+void HeadPoseEstimation::solvePoses() const {
+    // Already solved and drawn for these faces
+    if (posesValid) return;
+
+    cachedPoses.resize(faces.size());
+    cachedFacePoses.resize(faces.size());
+
+    // Solve every face on the pool, results keep the order of faces. Each
+    // face has its own track, so the tracks can take the results right away.
+    const long long now = nowMillis();
+    parallel_for(*pool, 0, faces.size(), [&](long i) {
+        cachedFacePoses[i] = estimatePose(i);
+        cachedPoses[i] = toHeadPose(cachedFacePoses[i]);
+
+        FaceTrack& track = tracker.tracks()[faceTracks[i]];
+        track.rvec = cachedFacePoses[i].rvec;
+        track.tvec = cachedFacePoses[i].tvec;
+        track.has_pose = true;
+        track.pose_time = now;
+    });
+
+    // All faces draw onto the same resultMat, so this part stays sequential
+    if (renderer.enabled) {
+        for (size_t i = 0; i < faces.size(); i++) {
+            renderer.drawPose(resultMat, cachedFacePoses[i], mode, cameraMatrix);
+        }
+    }
 
-    return pose;
+    posesValid = true;
 }
 
-std::vector<head_pose> HeadPoseEstimation::poses() const {
-    std::vector<head_pose> res;
-    for (auto i = 0; i < faces.size(); i++){
-        res.push_back(pose(i));
+int HeadPoseEstimation::packResults(float* out, size_t capacity) const {
+    if (capacity < (size_t) PACKED_HEADER_SIZE) return 0;
+    const std::vector<FacePose>& face_poses = facePoses();
+    const size_t written = std::min(face_poses.size(), (capacity - PACKED_HEADER_SIZE) / PACKED_FACE_SIZE);
+    out[PACKED_FACES_WRITTEN] = written;
+    out[PACKED_FACES_DETECTED] = face_poses.size();
+
+    const std::vector<unsigned long>& model_landmarks = landmarkModel->landmarks;
+    for (size_t i = 0; i < written; i++) {
+        float* face = out + PACKED_HEADER_SIZE + i * PACKED_FACE_SIZE;
+        const FacePose& face_pose = face_poses[i];
+
+        face[PACKED_ID] = faceId(i);
+        face[PACKED_BOX] = faces[i].left();
+        face[PACKED_BOX + 1] = faces[i].top();
+        face[PACKED_BOX + 2] = faces[i].width();
+        face[PACKED_BOX + 3] = faces[i].height();
+
+        // Pruned models put each part back at its landmark of the 68 point model
+        std::fill(face + PACKED_LANDMARKS, face + PACKED_POSE, std::numeric_limits<float>::quiet_NaN());
+        const full_object_detection& shape = shapes[i];
+        for (unsigned long part = 0; part < shape.num_parts(); part++) {
+            const unsigned long landmark = landmarkParts.empty() ? part : model_landmarks[part];
+            if (landmark >= (unsigned long) PACKED_NUM_LANDMARKS) continue;
+            face[PACKED_LANDMARKS + 2 * landmark] = shape.part(part).x();
+            face[PACKED_LANDMARKS + 2 * landmark + 1] = shape.part(part).y();
+        }
+
+        const head_pose pose = toHeadPose(face_pose);
+        for (int j = 0; j < 16; j++) face[PACKED_POSE + j] = pose.val[j];
+
+        face[PACKED_ANGLES] = face_pose.yaw * 180 / M_PI;
+        face[PACKED_ANGLES + 1] = face_pose.pitch * 180 / M_PI;
+        face[PACKED_ANGLES + 2] = face_pose.roll * 180 / M_PI;
+        for (int j = 0; j < 3; j++) face[PACKED_CAMERA + j] = face_pose.camera[j] / 1000;
     }
-    return res;
+    return written;
+}
+
+int HeadPoseEstimation::faceId(size_t face_idx) const {
+    return track(face_idx).id;
+}
+
+const FaceTrack& HeadPoseEstimation::track(size_t face_idx) const {
+    return tracker.tracks()[faceTracks[face_idx]];
 }
 
 /** Return the point corresponding to the dictionary marker.
 */
 Point2f HeadPoseEstimation::coordsOf(size_t face_idx, FACIAL_FEATURE feature) const {
+    if (!landmarkParts.empty()) {
+        DLIB_ASSERT(landmarkParts[feature] != ULONG_MAX, "Landmark " << feature << " pruned from the model");
+        return toCv(shapes[face_idx].part(landmarkParts[feature]));
+    }
     return toCv(shapes[face_idx].part(feature));
 }
 
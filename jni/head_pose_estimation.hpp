@@ -6,46 +6,26 @@
 #include <dlib/image_processing.h>
 #include <dlib/image_processing/frontal_face_detector.h>
 
+#include "face_detector.hpp"
+#include "motion_mask.hpp"
+#include "frame_signature.hpp"
+#include "face_tracker.hpp"
+#include "head_pose_solver.hpp"
+#include "head_model.hpp"
+#include "pose_renderer.hpp"
+#include "landmark_pruning.hpp"
+#include "compact_shape_predictor.hpp"
+#include "model_registry.hpp"
+#include "packed_results.hpp"
+
+#include <cfloat>
+#include <climits>
 #include <vector>
 #include <array>
 #include <string>
 
-const static cv::Point3f P3D_SELLION(0., 0.,0.);
-const static cv::Point3f P3D_RIGHT_EYE(-20., -65.5,-5.);
-const static cv::Point3f P3D_LEFT_EYE(-20., 65.5,-5.);
-const static cv::Point3f P3D_RIGHT_EAR(-100., -77.5,-6.);
-const static cv::Point3f P3D_LEFT_EAR(-100., 77.5,-6.);
-const static cv::Point3f P3D_NOSE(21.0, 0., -48.0);
-const static cv::Point3f P3D_STOMMION(10.0, 0., -75.0);
-const static cv::Point3f P3D_MENTON(0., 0.,-133.0);
-
 static const int MAX_FEATURES_TO_TRACK=100;
 
-// Interesting facial features with their landmark index
-enum FACIAL_FEATURE {
-    NOSE=30,
-    RIGHT_EYE=36,
-    LEFT_EYE=45,
-    RIGHT_SIDE=0,
-    LEFT_SIDE=16,
-    EYEBROW_RIGHT=21,
-    EYEBROW_LEFT=22,
-    MOUTH_UP=51,
-    MOUTH_DOWN=57,
-    MOUTH_RIGHT=48,
-    MOUTH_LEFT=54,
-    SELLION=27,
-    MOUTH_CENTER_TOP=62,
-    MOUTH_CENTER_BOTTOM=66,
-    MENTON=8
-};
-
-const static int MODE_ITERATIVE = 0;
-const static int MODE_P3P = 1;
-const static int MODE_EPNP = 2;
-
-typedef cv::Matx44d head_pose;
-
 class HeadPoseEstimation {
 
 public:
@@ -59,13 +39,100 @@ public:
         float k2 = 0, 
         float p1 = 0, 
         float p2 = 0,
-        float k3 = 0);
+        float k3 = 0,
+        int min_face_size = 0,
+        int max_face_size = 0,
+        float pyramid_step = 0,
+        int landmark_pruning = PRUNE_NONE,
+        const std::string& face_detector_model = "");
 
     int detect(cv::Mat& image);
 
+    /** Prepares for frames of width x height so that the first one runs at
+     *  steady state speed: faults the model pages in, then runs a synthetic
+     *  frame through detection, landmarks and pose estimation, which sets up
+     *  the default camera matrix and every buffer sized by the frame. No
+     *  state of it is left behind: the face tracks and the ids they give are
+     *  those from before, and the next frame is scanned whole.
+     */
+    void warmup(int width, int height);
+
+    /** Skip scanning the regions whose mean intensity moved by no more than
+     *  threshold since the previous frame, reusing that frame's detections for
+     *  them. A full frame is scanned every refresh_interval frames, threshold 0
+     *  turns it off.
+     */
+    void setMotionGuidance(int threshold, int refresh_interval = 30);
+
+    /** Frames whose sampled luminance is within tolerance grey levels of the
+     *  last processed frame return its results without running detection or
+     *  pose estimation. A negative tolerance turns it off.
+     */
+    void setDuplicateTolerance(int tolerance);
+
+    /** MODE_ITERATIVE, MODE_GAUSS_NEWTON and MODE_FIVE_POINT start from the
+     *  last pose of the same face when warm_start is set, and stop after
+     *  max_iterations or once a step changes the pose by less than epsilon
+     *  (relative). These three modes solve in fixed-size storage, undistortion
+     *  included, and do not allocate; MODE_P3P and MODE_EPNP go through
+     *  cv::solvePnP, which does.
+     */
+    void setPoseSolver(bool warm_start, int max_iterations = 20, double epsilon = FLT_EPSILON);
+
+    /** Predicts landmarks with the flat, vectorized regression forest engine
+     *  of CompactShapePredictor instead of dlib's shape_predictor, for the
+     *  same landmarks to floating point rounding. A model file in the compact
+     *  layout always uses it; any other gets a second copy of the model, for
+     *  this estimator, while it is on.
+     */
+    void setForestEngine(bool enabled);
+
+    /** Runs only the first levels of the landmark cascade, for a linearly
+     *  cheaper but less accurate prediction; tools/benchmark_shape_predictor
+     *  reports the error of every depth for a model. levels <= 0 runs them
+     *  all. Turns the forest engine on, the only one able to stop early.
+     */
+    void setCascadeDepth(int levels);
+
+    /** Solves the pose of one face without side effects: neither resultMat
+     *  nor the face tracks change, so that any number of faces can be
+     *  estimated concurrently between two detect() calls.
+     */
+    FacePose estimatePose(size_t face_idx) const;
+
+    /** As estimatePose(), then draws the pose onto resultMat when the renderer
+     *  is enabled.
+     */
     head_pose pose(size_t face_idx) const;
 
-    std::vector<head_pose> poses() const;
+    /** Estimates every face, stores the poses in the face tracks (the warm
+     *  start of the next frame) and draws them onto resultMat when the renderer
+     *  is enabled. Valid until the next detect().
+     */
+    const std::vector<head_pose>& poses() const;
+
+    /** The poses() of the current faces as FacePose, with the angles, the
+     *  quaternion and the camera position already worked out. Valid until the
+     *  next detect().
+     */
+    const std::vector<FacePose>& facePoses() const;
+
+    /** Writes the faces of the last detect(), their landmarks and poses into
+     *  out as packed_results.hpp lays them out, as many faces as capacity
+     *  floats hold, and returns how many it wrote. Allocates nothing once
+     *  the poses are solved.
+     */
+    int packResults(float* out, size_t capacity) const;
+
+    /** Stable id of the person a face belongs to, the same across frames as
+     *  long as the face keeps being detected.
+     */
+    int faceId(size_t face_idx) const;
+
+    /** Cached state of the person a face belongs to: last rectangle,
+     *  landmarks, rvec/tvec and timestamps.
+     */
+    const FaceTrack& track(size_t face_idx) const;
 
     virtual inline double todeg(double rad) {  return rad * 180 / M_PI; }
 
@@ -84,16 +151,89 @@ public:
 
     int mode;
 
+    /*
+        detectionOptions – Face sizes the detector searches for, and the pyramid step between its levels.
+        Levels that can only hold faces outside [min_face_size, max_face_size] are neither built nor scanned.
+        filters / fallback_filters select the sub-detectors (FACE_FRONT, FACE_LEFT_PROFILE, ...) to run.
+        max_faces keeps only the best faces, so that landmarks and poses are computed for those alone.
+    */
+    DetectionOptions detectionOptions;
+
+    // Draws landmarks and poses onto resultMat. With renderer.enabled off,
+    // detect() leaves resultMat empty and neither clones nor draws.
+    PoseRenderer renderer;
+
 private:
     dlib::cv_image<dlib::bgr_pixel> current_image;
 
-    dlib::frontal_face_detector detector;
-    dlib::shape_predictor pose_model;
+    // Shared with the other estimators using the same models
+    std::shared_ptr<const FaceDetector> detector;
+
+    // Previous frame's state for motion guided detection
+    MotionMask motionMask;
+    ScanCache scanCache;
+
+    std::shared_ptr<const LandmarkModel> landmarkModel;
+    // The landmark model laid out for the forest engine, when it is on and
+    // the model file is not compact already
+    CompactShapePredictor forestEngine;
+    // Part of the landmark model for each landmark of the 68 point model,
+    // ULONG_MAX for a pruned one, empty when the model was not pruned
+    std::vector<unsigned long> landmarkParts;
+    // Levels of the cascade to run, ULONG_MAX for all
+    unsigned long cascadeDepth;
+
+    // Worker threads for the detector and the per-face stages, shared with
+    // the other estimators
+    std::shared_ptr<dlib::thread_pool> pool;
+
+    // Initial guess and stopping criteria of the iterative modes
+    bool warmStart;
+    cv::TermCriteria poseCriteria;
+
+    // Solvers of MODE_GAUSS_NEWTON and MODE_FIVE_POINT, set up for their models
+    HeadPoseSolver<PoseModel<MODE_GAUSS_NEWTON>::SIZE> headSolver;
+    HeadPoseSolver<PoseModel<MODE_FIVE_POINT>::SIZE> fivePointSolver;
 
     std::vector<dlib::rectangle> faces;
 
     std::vector<dlib::full_object_detection> shapes;
 
+    // Tracks across frames, and the track of each face. Mutable as poses()
+    // stores the solved poses in them.
+    mutable FaceTracker tracker;
+    std::vector<size_t> faceTracks;
+
+    // Near-duplicate frame detection
+    int duplicateTolerance;
+    FrameSignature lastSignature;
+
+    // Poses of the current faces, once solved
+    mutable std::vector<head_pose> cachedPoses;
+    mutable std::vector<FacePose> cachedFacePoses;
+    mutable bool posesValid;
+
+    void solvePoses() const;
+
+    /** Landmarks of a face of current_image, with the engine in use.
+     */
+    dlib::full_object_detection predictLandmarks(const dlib::rectangle& face) const;
+
+    template <int Mode>
+    void gatherPoints(size_t face_idx, cv::Point3f (&head_points)[PoseModel<Mode>::SIZE],
+                      cv::Point2f (&detected_points)[PoseModel<Mode>::SIZE]) const;
+
+    template <int Mode>
+    void solveMode(size_t face_idx, cv::Vec3d& rvec, cv::Vec3d& tvec) const;
+
+    template <int Mode>
+    void solveDedicated(size_t face_idx, const HeadPoseSolver<PoseModel<Mode>::SIZE>& solver,
+                        cv::Vec3d& rvec, cv::Vec3d& tvec) const;
+
+    template <int N>
+    int solveGaussNewton(const HeadPoseSolver<N>& solver, const cv::Point2f (&detected_points)[N],
+                         bool estimate, cv::Vec3d& rvec, cv::Vec3d& tvec) const;
+
     /** Return the point corresponding to the dictionary marker.
     */
     cv::Point2f coordsOf(size_t face_idx, FACIAL_FEATURE feature) const;
@@ -0,0 +1,178 @@
+#ifndef __HEAD_POSE_SOLVER
+#define __HEAD_POSE_SOLVER
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include <algorithm>
+
+/** Perspective-n-point solver for a rigid model of N points fixed at
+ *  construction, such as the head model.
+ *
+ *  Gauss-Newton on the rotation manifold with Levenberg-Marquardt damping and
+ *  an analytic Jacobian, everything in fixed-size Matx storage. The model is
+ *  centred once at construction, which also conditions the translation
+ *  better, so a solve only touches the N image points. Nothing is allocated.
+ */
+template <int N>
+class HeadPoseSolver {
+
+public:
+    typedef cv::Matx<double, N, 3> model_type;
+    typedef cv::Matx<double, N, 2> points_type;
+
+    explicit HeadPoseSolver(const model_type& model) {
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < 3; j++) centroid[j] += model(i,j) / N;
+        }
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < 3; j++) centered(i,j) = model(i,j) - centroid[j];
+        }
+        // Least squares fit of a linear map of the model, for estimate()
+        pseudo_inverse = (centered.t() * centered).inv(cv::DECOMP_CHOLESKY) * centered.t();
+    }
+
+    /** Closed-form pose under scaled orthographic projection, the first step
+     *  of POSIT: a start close enough for refine() without any previous pose.
+     *  The model must not be planar. Returns false, leaving R and t as they
+     *  are, when the image points are degenerate.
+     */
+    bool estimate(const points_type& image, double fx, double fy, double cx, double cy,
+                  cv::Matx33d& R, cv::Vec3d& t) const {
+        // Normalized image coordinates, and their mean, where the centroid shows
+        cv::Matx<double, N, 1> u, v;
+        double u0 = 0, v0 = 0;
+        for (int i = 0; i < N; i++) {
+            u(i) = (image(i,0) - cx) / fx;
+            v(i) = (image(i,1) - cy) / fy;
+            u0 += u(i) / N;
+            v0 += v(i) / N;
+        }
+        for (int i = 0; i < N; i++) {
+            u(i) -= u0;
+            v(i) -= v0;
+        }
+
+        // The first two rows of the rotation, both scaled by 1 / depth
+        const cv::Matx31d a = pseudo_inverse * u;
+        const cv::Matx31d b = pseudo_inverse * v;
+        const double na = cv::norm(a), nb = cv::norm(b);
+        if (na <= 0 || nb <= 0) return false;
+
+        const cv::Vec3d r1 = cv::Vec3d(a(0), a(1), a(2)) * (1 / na);
+        cv::Vec3d r2(b(0), b(1), b(2));
+        r2 -= r1 * r1.dot(r2);
+        const double n2 = cv::norm(r2);
+        if (n2 <= 0) return false;
+        r2 *= 1 / n2;
+        const cv::Vec3d r3 = r1.cross(r2);
+
+        R = cv::Matx33d(r1[0], r1[1], r1[2],
+                        r2[0], r2[1], r2[2],
+                        r3[0], r3[1], r3[2]);
+        const double depth = 2 / (na + nb);
+        t = cv::Vec3d(u0 * depth, v0 * depth, depth) - R * centroid;
+        return true;
+    }
+
+    /** Refines R and t, which bring model points into the camera frame, so that
+     *  the model projects onto image through a pinhole camera without
+     *  distortion. R and t must be a rough guess already, in front of the
+     *  camera. Returns the number of iterations run.
+     */
+    int refine(const points_type& image, double fx, double fy, double cx, double cy,
+               cv::Matx33d& R, cv::Vec3d& t, const cv::TermCriteria& criteria) const {
+        const int max_iter = (criteria.type & cv::TermCriteria::COUNT) ? criteria.maxCount : 100;
+        const double epsilon = (criteria.type & cv::TermCriteria::EPS) ? criteria.epsilon : 0;
+
+        // Work with the translation of the centroid
+        cv::Vec3d tc = R * centroid + t;
+        double err = error(image, fx, fy, cx, cy, R, tc);
+        double lambda = 1e-3;
+
+        int iter = 0;
+        while (iter < max_iter) {
+            // Normal equations in (rotation increment, translation increment)
+            cv::Matx66d A;
+            cv::Vec6d b;
+            for (int i = 0; i < N; i++) {
+                const cv::Vec3d q = R * cv::Vec3d(centered(i,0), centered(i,1), centered(i,2));
+                const cv::Vec3d X = q + tc;
+                const double iz = 1. / X[2];
+                const double ru = fx * X[0] * iz + cx - image(i,0);
+                const double rv = fy * X[1] * iz + cy - image(i,1);
+
+                // Projection derivatives, chained with dX/dw = -[q]x and dX/dt = I
+                const double du[3] = { fx * iz, 0, -fx * X[0] * iz * iz };
+                const double dv[3] = { 0, fy * iz, -fy * X[1] * iz * iz };
+                const double Ju[6] = { du[2] * q[1] - du[1] * q[2],
+                                       du[0] * q[2] - du[2] * q[0],
+                                       du[1] * q[0] - du[0] * q[1],
+                                       du[0], du[1], du[2] };
+                const double Jv[6] = { dv[2] * q[1] - dv[1] * q[2],
+                                       dv[0] * q[2] - dv[2] * q[0],
+                                       dv[1] * q[0] - dv[0] * q[1],
+                                       dv[0], dv[1], dv[2] };
+
+                for (int j = 0; j < 6; j++) {
+                    b[j] += Ju[j] * ru + Jv[j] * rv;
+                    for (int k = j; k < 6; k++) A(j,k) += Ju[j] * Ju[k] + Jv[j] * Jv[k];
+                }
+            }
+            for (int j = 0; j < 6; j++) {
+                for (int k = 0; k < j; k++) A(j,k) = A(k,j);
+            }
+
+            // Raise the damping until a step lowers the error
+            cv::Vec6d delta;
+            bool improved = false;
+            while (!improved && lambda < 1e16) {
+                cv::Matx66d damped = A;
+                for (int j = 0; j < 6; j++) damped(j,j) *= 1 + lambda;
+                delta = damped.solve(b, cv::DECOMP_CHOLESKY);
+
+                cv::Matx33d dR;
+                cv::Rodrigues(cv::Vec3d(-delta[0], -delta[1], -delta[2]), dR);
+                const cv::Matx33d candidate_R = dR * R;
+                const cv::Vec3d candidate_t(tc[0] - delta[3], tc[1] - delta[4], tc[2] - delta[5]);
+
+                const double candidate_err = error(image, fx, fy, cx, cy, candidate_R, candidate_t);
+                if (candidate_err <= err) {
+                    R = candidate_R;
+                    tc = candidate_t;
+                    err = candidate_err;
+                    lambda = std::max(lambda / 10, 1e-16);
+                    improved = true;
+                } else {
+                    lambda *= 10;
+                }
+            }
+            iter++;
+            if (!improved || cv::norm(delta) <= epsilon * (1 + cv::norm(tc))) break;
+        }
+
+        t = tc - R * centroid;
+        return iter;
+    }
+
+private:
+    /** Sum of squared reprojection errors, tc being the centroid translation.
+     */
+    double error(const points_type& image, double fx, double fy, double cx, double cy,
+                 const cv::Matx33d& R, const cv::Vec3d& tc) const {
+        double err = 0;
+        for (int i = 0; i < N; i++) {
+            const cv::Vec3d X = R * cv::Vec3d(centered(i,0), centered(i,1), centered(i,2)) + tc;
+            const double ru = fx * X[0] / X[2] + cx - image(i,0);
+            const double rv = fy * X[1] / X[2] + cy - image(i,1);
+            err += ru * ru + rv * rv;
+        }
+        return err;
+    }
+
+    cv::Vec3d centroid;
+    model_type centered;
+    cv::Matx<double, 3, N> pseudo_inverse;
+};
+
+#endif // __HEAD_POSE_SOLVER
@@ -3,13 +3,99 @@
 #include <jni.h>
 #include <glog/logging.h>
 #include "head_pose_estimation.cpp"
-#include "LinearMath/Matrix3x3.h"
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 using namespace cv;
 
+// Returned instead of JNI_OK while jniInit is still loading the models
+const static jint HPE_NOT_READY = 1;
+
 namespace {
-  std::shared_ptr<HeadPoseEstimation> gHeadPoseEstimationPtr;
+  /** One estimator behind the handle jniInit returns. Calls on a handle run
+   *  one at a time, calls on different handles run concurrently: estimators
+   *  only share the read-only models of the ModelRegistry.
+   */
+  struct EstimatorHandle {
+    EstimatorHandle() : loading(false), closed(false) {}
+
+    /** JNI_OK once loaded, HPE_NOT_READY while loading, JNI_ERR when loading
+     *  failed or jniDeInit closed the handle. Called with stateMutex held.
+     */
+    jint status() const {
+      if (closed) return JNI_ERR;
+      if (estimator) return JNI_OK;
+      return loading ? HPE_NOT_READY : JNI_ERR;
+    }
+
+    // Held for the whole of every call on this estimator
+    std::mutex callMutex;
+
+    // Frame conversion buffers, under callMutex, reused from call to call
+    cv::Mat rgbaMat;
+    cv::Mat bgrMat;
+
+    // Set by the loader thread jniInit starts and by jniDeInit, read under
+    // stateMutex
+    std::mutex stateMutex;
+    std::shared_ptr<HeadPoseEstimation> estimator;
+    std::thread loader;
+    bool loading;
+    bool closed;
+  };
+
+  // The open handles by the id jniInit returned. A call holds its handle
+  // through a shared_ptr, so that jniDeInit never frees it under the call.
+  std::mutex gHandlesMutex;
+  std::map<jlong, std::shared_ptr<EstimatorHandle> > gHandles;
+  jlong gNextHandle = 1;
+
+  std::shared_ptr<EstimatorHandle> findHandle(jlong id) {
+    std::lock_guard<std::mutex> lock(gHandlesMutex);
+    std::map<jlong, std::shared_ptr<EstimatorHandle> >::const_iterator it = gHandles.find(id);
+    return it != gHandles.end() ? it->second : std::shared_ptr<EstimatorHandle>();
+  }
+
+  /** The call mutex of a handle, held while the call lasts, and its
+   *  estimator, null while it is loading, when loading failed or once the
+   *  handle is closed.
+   */
+  class EstimatorCall {
+  public:
+    explicit EstimatorCall(jlong id) : handle(findHandle(id)) {
+      if (handle) {
+        lock = std::unique_lock<std::mutex>(handle->callMutex);
+        std::lock_guard<std::mutex> state(handle->stateMutex);
+        if (!handle->closed) estimator = handle->estimator;
+      }
+    }
+
+    /** Status of a call made without an estimator.
+     */
+    jint notReadyStatus() const {
+      if (!handle) return JNI_ERR;
+      std::lock_guard<std::mutex> state(handle->stateMutex);
+      return handle->status() == HPE_NOT_READY ? HPE_NOT_READY : JNI_ERR;
+    }
+
+    /** The conversion buffers of the handle, only with an estimator.
+     */
+    cv::Mat& rgbaMat() { return handle->rgbaMat; }
+    cv::Mat& bgrMat() { return handle->bgrMat; }
+
+    std::shared_ptr<HeadPoseEstimation> estimator;
+
+  private:
+    std::shared_ptr<EstimatorHandle> handle;
+    std::unique_lock<std::mutex> lock;
+  };
+
+  // Guards the Java class references below, shared by every handle
+  std::mutex gClassesMutex;
 }
 
 #ifdef __cplusplus
@@ -18,10 +104,58 @@ extern "C" {
 
 static jclass HeadPoseGaze;
   static jmethodID HeadPoseGazeConstructor;
+  static bool HeadPoseGazeHasId;
 
 static jclass ArrayList;
   static jmethodID ArrayListAdd;
 
+/** Looks the Java classes and methods up, once for all handles.
+ */
+static bool initClassReferences(JNIEnv* env) {
+  std::lock_guard<std::mutex> lock(gClassesMutex);
+  if (HeadPoseGaze && ArrayList) return true;
+
+  jclass HeadPoseGaze_local = env->FindClass("com/beraldo/hpe/dlib/HeadPoseGaze");
+  if(HeadPoseGaze_local == NULL) {
+      LOG(FATAL) << "Can't Find Class \"HeadPoseGaze\".\n";
+      return false;
+  }
+  
+  jclass ArrayList_local = env->FindClass("java/util/ArrayList");
+  if(ArrayList_local == NULL) {
+      LOG(FATAL) << "Can't Find Class \"ArrayList\".\n";
+      return false;
+  }
+
+  // Obtain global refs...
+  HeadPoseGaze = reinterpret_cast<jclass>(env->NewGlobalRef(HeadPoseGaze_local));
+  // Prefer the constructor taking the face id, older HeadPoseGaze only have (yaw, pitch, roll)
+  HeadPoseGazeConstructor = env->GetMethodID(HeadPoseGaze, "<init>", "(IDDD)V");
+  HeadPoseGazeHasId = HeadPoseGazeConstructor != NULL;
+  if(!HeadPoseGazeHasId) {
+      env->ExceptionClear();
+      HeadPoseGazeConstructor = env->GetMethodID(HeadPoseGaze, "<init>", "(DDD)V");
+  }
+  if(HeadPoseGazeConstructor == NULL) {
+      LOG(FATAL) << "Can't Find Method(s) in HeadPoseGaze.\n";
+      return false;
+  }
+
+  ArrayList = reinterpret_cast<jclass>(env->NewGlobalRef(ArrayList_local));
+  ArrayListAdd = env->GetMethodID(ArrayList, "add", "(Ljava/lang/Object;)Z");
+  if(ArrayListAdd == NULL) {
+      LOG(FATAL) << "Can't Find Method(s) in ArrayList.\n";
+      return false;
+  }
+
+  // ...delete local refs
+  env->DeleteLocalRef(HeadPoseGaze_local);
+  env->DeleteLocalRef(ArrayList_local);
+
+  LOG(INFO) << "Classes and method references init OK";
+  return true;
+}
+
 // ========================================================
 // JNI Mapping Methods
 // ========================================================
@@ -38,78 +172,141 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved) {
   return JNI_VERSION_1_6;
 }
 
+void JNI_OnUnload(JavaVM* vm, void* reserved) {
+  JNIEnv* env = NULL;
+  if (vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK) return;
+
+  std::lock_guard<std::mutex> lock(gClassesMutex);
+  if (HeadPoseGaze) env->DeleteGlobalRef(HeadPoseGaze);
+  if (ArrayList) env->DeleteGlobalRef(ArrayList);
+  HeadPoseGaze = NULL;
+  ArrayList = NULL;
+}
+
 // Macro to define correctly native method names
 #define DLIB_JNI_METHOD(METHOD_NAME) \
   Java_com_beraldo_hpe_dlib_HeadPoseDetector_##METHOD_NAME
 
 jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniBitmapExtractFaceGazes)(JNIEnv* env, jobject thiz,
+            jlong handle,
             jobject bitmap,
 					  jobject gazesList) {
 
-  if (gHeadPoseEstimationPtr) {
-    cv::Mat rgbaMat;
-    cv::Mat bgrMat;
-    jnicommon::ConvertBitmapToRGBAMat(env, bitmap, rgbaMat, true, false, false);
-    cv::cvtColor(rgbaMat, bgrMat, cv::COLOR_RGBA2BGR);
-    
-    jint size = gHeadPoseEstimationPtr->detect(bgrMat);
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    cv::Mat& bgrMat = call.bgrMat();
+    jnicommon::ConvertBitmapToRGBAMat(env, bitmap, call.rgbaMat(), true, false, false);
+    cv::cvtColor(call.rgbaMat(), bgrMat, cv::COLOR_RGBA2BGR);
+
+    // The only entry point that returns the drawn frame
+    estimator->renderer.enabled = true;
+    jint size = estimator->detect(bgrMat);
     LOG(INFO) << "Number of faces detected: " << size;
 
-    auto poses = gHeadPoseEstimationPtr->poses();
+    // Angles and camera position come straight from each face's rvec/tvec
+    const std::vector<FacePose>& poses = estimator->facePoses();
 
     int i = 0;
     jobject gaze_found = NULL;
     LOG(INFO) << "{";
-    for(auto pose : poses) {
-        pose = pose.inv();
-
-        double raw_yaw, raw_pitch, raw_roll;
-        tf::Matrix3x3 mrot(
-                pose(0,0), pose(0,1), pose(0,2),
-                pose(1,0), pose(1,1), pose(1,2),
-                pose(2,0), pose(2,1), pose(2,2));
-        mrot.getRPY(raw_roll, raw_pitch, raw_yaw);
-
-        raw_roll = raw_roll - M_PI/2;
-        raw_yaw = raw_yaw + M_PI/2;
-
-        double yaw, pitch, roll;
-
-        roll = raw_pitch;
-        yaw = raw_yaw;
-        pitch = -raw_roll;
+    for(const FacePose& pose : poses) {
+        const double yaw = pose.yaw;
+        const double pitch = pose.pitch;
+        const double roll = pose.roll;
 
+        const int id = estimator->faceId(i);
         LOG(INFO) << "\"face_" << i << "\":";
 
-        LOG(INFO) << setprecision(1) << fixed << "{\"yaw\":" << 
-          gHeadPoseEstimationPtr->todeg(yaw) << ", \"pitch\":" << 
-          gHeadPoseEstimationPtr->todeg(pitch) << ", \"roll\":" << 
-          gHeadPoseEstimationPtr->todeg(roll) << ",";
+        LOG(INFO) << setprecision(1) << fixed << "{\"id\":" << id << ", \"yaw\":" << 
+          estimator->todeg(yaw) << ", \"pitch\":" << 
+          estimator->todeg(pitch) << ", \"roll\":" << 
+          estimator->todeg(roll) << ",";
 
         LOG(INFO) << setprecision(4) << fixed << 
-          "\"x\":" << pose(0,3) << ", \"y\":" << pose(1,3) << 
-          ", \"z\":" << pose(2,3) << "},";
+          "\"x\":" << pose.camera[0] / 1000 << ", \"y\":" << pose.camera[1] / 1000 << 
+          ", \"z\":" << pose.camera[2] / 1000 << "},";
 
         i++;
         // Call add method on an object created from another method call
-        gaze_found = env->NewObject(HeadPoseGaze, HeadPoseGazeConstructor, 
-          gHeadPoseEstimationPtr->todeg(yaw), 
-          gHeadPoseEstimationPtr->todeg(pitch), 
-          gHeadPoseEstimationPtr->todeg(roll));
+        if (HeadPoseGazeHasId) {
+          gaze_found = env->NewObject(HeadPoseGaze, HeadPoseGazeConstructor,
+            (jint) id,
+            estimator->todeg(yaw),
+            estimator->todeg(pitch),
+            estimator->todeg(roll));
+        } else {
+          gaze_found = env->NewObject(HeadPoseGaze, HeadPoseGazeConstructor, 
+            estimator->todeg(yaw), 
+            estimator->todeg(pitch), 
+            estimator->todeg(roll));
+        }
         env->CallBooleanMethod(gazesList, ArrayListAdd, gaze_found);
     }
     LOG(INFO) << "}" << flush;
 
     // Produce the bitmap to display
     cv::Mat rgbaResultMat;
-    cv::cvtColor(gHeadPoseEstimationPtr -> resultMat, rgbaResultMat, cv::COLOR_BGR2RGBA);
+    cv::cvtColor(estimator-> resultMat, rgbaResultMat, cv::COLOR_BGR2RGBA);
     jnicommon::ConvertRGBAMatToBitmap(env, bitmap, rgbaResultMat, true);
 
     return JNI_OK;
-  } else return JNI_ERR;
+  } else return call.notReadyStatus();
+}
+
+/** Detects on bitmap and solves the poses, for the packed entry points. The
+ *  bitmap is left as it is, so nothing is drawn, and the frame goes through
+ *  the conversion buffers of the handle.
+ */
+static void detectBitmap(JNIEnv* env, EstimatorCall& call, jobject bitmap) {
+  HeadPoseEstimation* estimator = call.estimator.get();
+  jnicommon::ConvertBitmapToRGBAMat(env, bitmap, call.rgbaMat(), true, false, false);
+  cv::cvtColor(call.rgbaMat(), call.bgrMat(), cv::COLOR_RGBA2BGR);
+  estimator->renderer.enabled = false;
+  estimator->detect(call.bgrMat());
+  estimator->facePoses();
+}
+
+// Both packed entry points write the layout of packed_results.hpp, face
+// count first, and return JNI_OK; nothing is allocated on the Java side.
+
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniDetectPacked)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jobject bitmap,
+            jfloatArray results) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    detectBitmap(env, call, bitmap);
+    // No JNI call may run while the array is held
+    const jsize capacity = env->GetArrayLength(results);
+    float* out = static_cast<float*>(env->GetPrimitiveArrayCritical(results, NULL));
+    if (!out) return JNI_ERR;
+    call.estimator->packResults(out, capacity);
+    env->ReleasePrimitiveArrayCritical(results, out, 0);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
+
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniDetectPackedBuffer)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jobject bitmap,
+            jobject results) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    // A direct ByteBuffer in native byte order (ByteOrder.nativeOrder()),
+    // starting on a float boundary: a slice at an odd offset is not
+    void* address = env->GetDirectBufferAddress(results);
+    const jlong capacity = env->GetDirectBufferCapacity(results);
+    if (!address || capacity < 0) return JNI_ERR;
+    if (reinterpret_cast<uintptr_t>(address) % alignof(float) != 0) return JNI_ERR;
+    float* out = static_cast<float*>(address);
+    detectBitmap(env, call, bitmap);
+    call.estimator->packResults(out, capacity / sizeof(float));
+    return JNI_OK;
+  } else return call.notReadyStatus();
 }
 
-jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniInit)(JNIEnv* env, jobject thiz,
+jlong JNIEXPORT JNICALL DLIB_JNI_METHOD(jniInit)(JNIEnv* env, jobject thiz,
             jstring landmarkPath,
             jint mode,
             jfloat fx,
@@ -120,57 +317,192 @@ jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniInit)(JNIEnv* env, jobject thiz,
             jfloat k2,
             jfloat p1,
             jfloat p2,
-            jfloat k3) {
-  // Initialize a new estimator if it's not already there
-  if (!gHeadPoseEstimationPtr) {
-    const char* landmarkmodel_path = env->GetStringUTFChars(landmarkPath, 0);
-    LOG(INFO) << "Initializing new HeadPoseEstimation, landmarkPath " << landmarkmodel_path << " and mode "<< mode << "and some params...";
-    gHeadPoseEstimationPtr = std::make_shared<HeadPoseEstimation>(landmarkmodel_path, mode, fx, fy, cx, cy, k1, k2, p1, p2, k3);
-    env->ReleaseStringUTFChars(landmarkPath, landmarkmodel_path);
-  }
+            jfloat k3,
+            jint minFaceSize,
+            jint maxFaceSize,
+            jfloat pyramidStep,
+            jint landmarkPruning,
+            jstring detectorPath) {
+  if (!initClassReferences(env)) return 0;
+
+  // Every call makes a new estimator, behind the handle returned. The models
+  // load on a background thread, jniIsReady tells when they are.
+  const char* landmarkmodel_path = env->GetStringUTFChars(landmarkPath, 0);
+  // No detector path uses the detector embedded in dlib
+  const char* detectormodel_path = detectorPath ? env->GetStringUTFChars(detectorPath, 0) : "";
+  LOG(INFO) << "Loading new HeadPoseEstimation, landmarkPath " << landmarkmodel_path << ", detectorPath "
+            << detectormodel_path << " and mode "<< mode << "and some params...";
+  const std::string landmark_model(landmarkmodel_path), detector_model(detectormodel_path);
+  env->ReleaseStringUTFChars(landmarkPath, landmarkmodel_path);
+  if (detectorPath) env->ReleaseStringUTFChars(detectorPath, detectormodel_path);
+
+  std::shared_ptr<EstimatorHandle> estimator_handle = std::make_shared<EstimatorHandle>();
+  // jniDeInit joins the loader before the handle can go
+  EstimatorHandle* handle = estimator_handle.get();
+  std::lock_guard<std::mutex> lock(handle->stateMutex);
+  handle->loading = true;
+  handle->loader = std::thread([=]() {
+    std::shared_ptr<HeadPoseEstimation> estimator;
+    try {
+      estimator = std::make_shared<HeadPoseEstimation>(landmark_model, mode, fx, fy, cx, cy, k1, k2, p1, p2, k3,
+        minFaceSize, maxFaceSize, pyramidStep, landmarkPruning, detector_model);
+      LOG(INFO) << "HeadPoseEstimation ready";
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Loading HeadPoseEstimation failed: " << e.what();
+    }
+    std::lock_guard<std::mutex> lock(handle->stateMutex);
+    handle->estimator = estimator;
+    handle->loading = false;
+  });
+
+  std::lock_guard<std::mutex> handles_lock(gHandlesMutex);
+  const jlong id = gNextHandle++;
+  gHandles[id] = estimator_handle;
+  return id;
+}
 
-  // Initialize references to classes and methods
-  jclass HeadPoseGaze_local = env->FindClass("com/beraldo/hpe/dlib/HeadPoseGaze");
-  if(HeadPoseGaze_local == NULL) {
-      LOG(FATAL) << "Can't Find Class \"HeadPoseGaze\".\n";
-      return JNI_ERR;
-  }
-  
-  jclass ArrayList_local = env->FindClass("java/util/ArrayList");
-  if(ArrayList_local == NULL) {
-      LOG(FATAL) << "Can't Find Class \"ArrayList\".\n";
-      return JNI_ERR;
-  }
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetDetectorFilters)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jint filters,
+            jint fallbackFilters) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    LOG(INFO) << "Setting detector filters " << filters << " and fallback filters " << fallbackFilters;
+    estimator->detectionOptions.filters = filters;
+    estimator->detectionOptions.fallback_filters = fallbackFilters;
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
 
-  // Obtain global refs...
-  HeadPoseGaze = reinterpret_cast<jclass>(env->NewGlobalRef(HeadPoseGaze_local));
-  HeadPoseGazeConstructor = env->GetMethodID(HeadPoseGaze, "<init>", "(DDD)V");
-  if(HeadPoseGazeConstructor == NULL) {
-      LOG(FATAL) << "Can't Find Method(s) in HeadPoseGaze.\n";
-      return JNI_ERR;
-  }
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetMaxFaces)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jint maxFaces,
+            jint rankBy,
+            jfloat stopConfidence) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    LOG(INFO) << "Keeping at most " << maxFaces << " faces ranked by " << rankBy << ", stop confidence " << stopConfidence;
+    estimator->detectionOptions.max_faces = std::max(0, maxFaces);
+    estimator->detectionOptions.rank_by = rankBy;
+    estimator->detectionOptions.stop_confidence = stopConfidence;
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
 
-  ArrayList = reinterpret_cast<jclass>(env->NewGlobalRef(ArrayList_local));
-  ArrayListAdd = env->GetMethodID(ArrayList, "add", "(Ljava/lang/Object;)Z");
-  if(ArrayListAdd == NULL) {
-      LOG(FATAL) << "Can't Find Method(s) in ArrayList.\n";
-      return JNI_ERR;
-  }
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetMotionGuidance)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jint threshold,
+            jint refreshInterval) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    estimator->setMotionGuidance(threshold, refreshInterval);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
 
-  // ...delete local refs
-  env->DeleteLocalRef(HeadPoseGaze_local);
-  env->DeleteLocalRef(ArrayList_local);
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetDuplicateTolerance)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jint tolerance) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    estimator->setDuplicateTolerance(tolerance);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
 
-  LOG(INFO) << "Classes and method references init OK";
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetPoseSolver)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jboolean warmStart,
+            jint maxIterations,
+            jdouble epsilon) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    estimator->setPoseSolver(warmStart, maxIterations, epsilon);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
+
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetForestEngine)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jboolean enabled) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    estimator->setForestEngine(enabled);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
+
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetCascadeDepth)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jint levels) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    estimator->setCascadeDepth(levels);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
+
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniWarmup)(JNIEnv* env, jobject thiz,
+            jlong handle,
+            jint width,
+            jint height) {
+  EstimatorCall call(handle);
+  if (call.estimator) {
+    HeadPoseEstimation* estimator = call.estimator.get();
+    estimator->warmup(width, height);
+    return JNI_OK;
+  } else return call.notReadyStatus();
+}
 
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniSetModelRetention)(JNIEnv* env, jobject thiz,
+            jint models) {
+  // Process-wide, does not need an estimator
+  ModelRegistry::instance().setRetention(std::max(0, models));
   return JNI_OK;
 }
 
-jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniDeInit)(JNIEnv* env, jobject thiz) {
-  gHeadPoseEstimationPtr.reset();
-  env->DeleteGlobalRef(HeadPoseGaze);
-  env->DeleteGlobalRef(ArrayList);
-  
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniIsReady)(JNIEnv* env, jobject thiz,
+            jlong handle) {
+  // Never waits for a call running on the handle
+  std::shared_ptr<EstimatorHandle> estimator_handle = findHandle(handle);
+  if (!estimator_handle) return JNI_ERR;
+  std::lock_guard<std::mutex> state(estimator_handle->stateMutex);
+  return estimator_handle->status();
+}
+
+jint JNIEXPORT JNICALL DLIB_JNI_METHOD(jniDeInit)(JNIEnv* env, jobject thiz,
+            jlong handle) {
+  std::shared_ptr<EstimatorHandle> estimator_handle;
+  {
+    std::lock_guard<std::mutex> lock(gHandlesMutex);
+    std::map<jlong, std::shared_ptr<EstimatorHandle> >::iterator it = gHandles.find(handle);
+    if (it == gHandles.end()) return JNI_ERR;
+    estimator_handle = it->second;
+    gHandles.erase(it);
+  }
+
+  // Calls from now on, and those still waiting for the call mutex, find the
+  // handle closed. Waits for a load in progress, which cannot be interrupted,
+  // and for the call running on the handle before freeing the estimator; the
+  // handle itself goes with the last call holding it.
+  std::unique_lock<std::mutex> state(estimator_handle->stateMutex);
+  estimator_handle->closed = true;
+  std::thread loader(std::move(estimator_handle->loader));
+  state.unlock();
+  if (loader.joinable()) loader.join();
+  {
+    std::lock_guard<std::mutex> lock(estimator_handle->callMutex);
+    std::lock_guard<std::mutex> state_lock(estimator_handle->stateMutex);
+    estimator_handle->estimator.reset();
+  }
+
   return JNI_OK;
 }
 
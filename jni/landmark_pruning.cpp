@@ -0,0 +1,90 @@
+#include "landmark_pruning.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+using namespace dlib;
+
+void pruneLandmarks(ShapePredictorData& data, const std::vector<unsigned long>& landmarks, int pruning,
+                    std::vector<unsigned long>& kept) {
+    matrix<float,0,1>& initial_shape = data.initial_shape;
+    std::vector<std::vector<unsigned long> >& anchor_idx = data.anchor_idx;
+    std::vector<std::vector<dlib::vector<float,2> > >& deltas = data.deltas;
+
+    const unsigned long num_parts = initial_shape.size() / 2;
+    std::vector<bool> keep(num_parts, false);
+    for (unsigned long part : landmarks) {
+        // The list is for another kind of model, keep this one whole
+        if (part >= num_parts) {
+            LOG(WARNING) << "Landmark " << part << " not in a " << num_parts << " landmark model, not pruning it";
+            keep.assign(num_parts, true);
+            break;
+        }
+        keep[part] = true;
+    }
+    if (pruning == PRUNE_KEEP_ANCHORS) {
+        for (const std::vector<unsigned long>& level : anchor_idx) {
+            for (unsigned long part : level) keep[part] = true;
+        }
+    }
+
+    // Old index to new index of the kept landmarks
+    kept.clear();
+    std::vector<unsigned long> new_idx(num_parts, 0);
+    for (unsigned long part = 0; part < num_parts; part++) {
+        if (!keep[part]) continue;
+        new_idx[part] = kept.size();
+        kept.push_back(part);
+    }
+    if (kept.empty())
+        throw serialization_error("No landmark left after pruning the shape_predictor.");
+
+    // Features anchored to a dropped landmark move to the nearest kept one,
+    // keeping their place in the mean shape
+    const auto mean = [&](unsigned long part) {
+        return dlib::vector<float,2>(initial_shape(2 * part), initial_shape(2 * part + 1));
+    };
+    for (size_t level = 0; level < anchor_idx.size(); level++) {
+        for (size_t i = 0; i < anchor_idx[level].size(); i++) {
+            const unsigned long anchor = anchor_idx[level][i];
+            if (!keep[anchor]) {
+                unsigned long nearest = kept[0];
+                for (unsigned long part : kept) {
+                    if ((mean(part) - mean(anchor)).length_squared() < (mean(nearest) - mean(anchor)).length_squared())
+                        nearest = part;
+                }
+                deltas[level][i] += mean(anchor) - mean(nearest);
+                anchor_idx[level][i] = new_idx[nearest];
+            } else {
+                anchor_idx[level][i] = new_idx[anchor];
+            }
+        }
+    }
+
+    // Only the rows of the kept landmarks in the mean shape and the leaves
+    const auto prune = [&](const matrix<float,0,1>& shape) -> matrix<float,0,1> {
+        matrix<float,0,1> pruned(2 * kept.size());
+        for (size_t i = 0; i < kept.size(); i++) {
+            pruned(2 * i) = shape(2 * kept[i]);
+            pruned(2 * i + 1) = shape(2 * kept[i] + 1);
+        }
+        return pruned;
+    };
+    initial_shape = prune(initial_shape);
+    for (std::vector<impl::regression_tree>& forest : data.forests) {
+        for (impl::regression_tree& tree : forest) {
+            for (matrix<float,0,1>& leaf : tree.leaf_values) leaf = prune(leaf);
+        }
+    }
+
+    LOG(INFO) << "Pruned shape predictor from " << num_parts << " to " << kept.size() << " landmarks";
+}
+
+void deserializePruned(std::istream& in, const std::vector<unsigned long>& landmarks, int pruning,
+                       shape_predictor& predictor, std::vector<unsigned long>& kept) {
+    ShapePredictorData data;
+    readShapePredictor(in, data);
+    pruneLandmarks(data, landmarks, pruning, kept);
+    toShapePredictor(data, predictor);
+}
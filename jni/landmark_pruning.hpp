@@ -0,0 +1,40 @@
+#ifndef __LANDMARK_PRUNING
+#define __LANDMARK_PRUNING
+
+#include <dlib/image_processing.h>
+
+#include "shape_predictor_data.hpp"
+
+#include <istream>
+#include <vector>
+
+// How a shape_predictor is pruned down to the landmarks in use
+const static int PRUNE_NONE = 0;
+// Also keep every landmark a feature pixel is anchored to, so that no feature
+// pixel moves. The similarity transform is still fitted on the kept landmarks
+// only, so the features and predictions are close to, not exactly, those of
+// the full model
+const static int PRUNE_KEEP_ANCHORS = 1;
+// Move the feature pixels anchored to a dropped landmark onto the nearest kept
+// one, at the same place in the mean shape: the fewest landmarks
+const static int PRUNE_REANCHOR = 2;
+
+/** Keeps only the landmarks listed in a shape predictor (plus the anchors
+ *  with PRUNE_KEEP_ANCHORS), so that every tree leaf holds two floats per kept
+ *  landmark instead of per landmark of the model.
+ *
+ *  The similarity transform between the mean and the current shape is then
+ *  fitted on the kept landmarks only, so the predictions are close to, not
+ *  exactly, those of the full model. kept receives the index in the full model
+ *  of each landmark of the pruned one, in increasing order.
+ */
+void pruneLandmarks(ShapePredictorData& data, const std::vector<unsigned long>& landmarks, int pruning,
+                    std::vector<unsigned long>& kept);
+
+/** Reads a serialized dlib::shape_predictor and prunes it as pruneLandmarks()
+ *  does. Throws dlib::serialization_error as deserialize() does.
+ */
+void deserializePruned(std::istream& in, const std::vector<unsigned long>& landmarks, int pruning,
+                       dlib::shape_predictor& predictor, std::vector<unsigned long>& kept);
+
+#endif // __LANDMARK_PRUNING
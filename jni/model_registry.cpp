@@ -0,0 +1,175 @@
+#include "model_registry.hpp"
+#include "landmark_pruning.hpp"
+#include "head_model.hpp"
+
+#include <glog/logging.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace dlib;
+
+const static uint64_t SAMPLE_SIZE = 4096;
+
+/** Path and content of a file as a registry key. The content is an FNV-1a
+ *  hash of the file size and of a sample at its start, middle and end, since
+ *  hashing 100 MB on every load would cost what the registry saves.
+ */
+static std::string contentKey(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) throw serialization_error("Unable to open " + path + " for reading.");
+    in.seekg(0, std::ios::end);
+    const uint64_t size = in.tellg();
+
+    uint64_t hash = 14695981039346656037ULL;
+    const auto mix = [&hash](const char* bytes, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            hash ^= (unsigned char) bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    mix(reinterpret_cast<const char*>(&size), sizeof(size));
+    const uint64_t offsets[3] = { 0, size / 2, size > SAMPLE_SIZE ? size - SAMPLE_SIZE : 0 };
+    char sample[SAMPLE_SIZE];
+    for (uint64_t offset : offsets) {
+        in.clear();
+        in.seekg(offset);
+        in.read(sample, SAMPLE_SIZE);
+        mix(sample, in.gcount());
+    }
+
+    std::ostringstream key;
+    key << path << '#' << std::hex << hash;
+    return key.str();
+}
+
+/** The face detector at path. What convert_face_detector wrote is read with
+ *  its filters ready to use; a frontal_face_detector as dlib's serialize()
+ *  wrote it builds them again, and so does dlib's embedded copy, used without
+ *  a path, which also has to be decoded (base64, then entropy coded).
+ */
+static std::shared_ptr<const FaceDetector> loadFaceDetector(const std::string& path) {
+    if (path.empty()) {
+        LOG(INFO) << "Decoding the embedded face detector";
+        return std::make_shared<FaceDetector>(get_frontal_face_detector());
+    }
+    if (FaceDetector::isPrebuilt(path)) {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        return std::make_shared<FaceDetector>(in);
+    }
+    frontal_face_detector detector;
+    deserialize(path) >> detector;
+    return std::make_shared<FaceDetector>(detector);
+}
+
+ModelRegistry& ModelRegistry::instance() {
+    static ModelRegistry registry;
+    return registry;
+}
+
+ModelRegistry::ModelRegistry() : retention(2) {
+}
+
+template <typename Model, typename Load>
+std::shared_ptr<const Model> ModelRegistry::acquire(std::map<std::string, Entry<Model> >& models,
+                                                    const std::string& key, Load load) {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::shared_ptr<const Model> model = models[key].model.lock();
+    if (!model) {
+        std::shared_future<std::shared_ptr<const Model> > loading = models[key].loading;
+        if (loading.valid()) {
+            // Another estimator is loading it
+            lock.unlock();
+            model = loading.get();
+            lock.lock();
+        } else {
+            std::promise<std::shared_ptr<const Model> > loaded;
+            models[key].loading = loaded.get_future().share();
+            lock.unlock();
+            try {
+                model = load();
+            } catch (...) {
+                lock.lock();
+                models[key].loading = std::shared_future<std::shared_ptr<const Model> >();
+                loaded.set_exception(std::current_exception());
+                throw;
+            }
+            lock.lock();
+            // retain() keeps the entry of a load in flight, so it is still there
+            models[key].model = model;
+            models[key].loading = std::shared_future<std::shared_ptr<const Model> >();
+            loaded.set_value(model);
+        }
+    }
+    retain(model);
+    return model;
+}
+
+std::shared_ptr<const FaceDetector> ModelRegistry::faceDetector(const std::string& path) {
+    const std::string key = path.empty() ? std::string("embedded") : contentKey(path);
+    return acquire(detectors, key, [&]() -> std::shared_ptr<const FaceDetector> {
+        std::shared_ptr<const FaceDetector> detector = loadFaceDetector(path);
+        LOG(INFO) << "Loaded face detector " << key;
+        return detector;
+    });
+}
+
+std::shared_ptr<const LandmarkModel> ModelRegistry::landmarkModel(const std::string& path, int pruning) {
+    std::ostringstream key_stream;
+    key_stream << contentKey(path) << '/' << pruning;
+    const std::string key = key_stream.str();
+    return acquire(landmarkModels, key, [&]() -> std::shared_ptr<const LandmarkModel> {
+        std::shared_ptr<LandmarkModel> model = std::make_shared<LandmarkModel>();
+        if (CompactShapePredictor::isCompact(path)) {
+            // Converted (and maybe pruned) offline, used straight from the mapped file
+            model->compact.load(path);
+            for (unsigned long i = 0; i < model->compact.num_parts(); i++)
+                model->landmarks.push_back(model->compact.landmark(i));
+            LOG(INFO) << "Mapped compact landmark model with " << model->compact.num_parts() << " landmarks";
+        } else if (pruning == PRUNE_NONE) {
+            deserialize(path) >> model->predictor;
+        } else {
+            // Pruning drops the landmarks no pose mode reads while loading
+            std::ifstream in(path.c_str(), std::ios::binary);
+            if (!in) throw serialization_error("Unable to open " + path + " for reading.");
+            deserializePruned(in, poseLandmarks(), pruning, model->predictor, model->landmarks);
+        }
+        LOG(INFO) << "Loaded landmark model " << key;
+        return model;
+    });
+}
+
+std::shared_ptr<dlib::thread_pool> ModelRegistry::threadPool() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<dlib::thread_pool> shared = pool.lock();
+    if (!shared) {
+        shared = std::make_shared<dlib::thread_pool>(std::max(1U, std::thread::hardware_concurrency()));
+        pool = shared;
+        LOG(INFO) << "Started " << shared->num_threads_in_pool() << " worker threads";
+    }
+    return shared;
+}
+
+void ModelRegistry::setRetention(size_t models) {
+    std::lock_guard<std::mutex> lock(mutex);
+    LOG(INFO) << "Model retention " << models;
+    retention = models;
+    if (retained.size() > retention) retained.resize(retention);
+}
+
+void ModelRegistry::retain(const std::shared_ptr<const void>& model) {
+    retained.remove(model);
+    retained.push_front(model);
+    if (retained.size() > retention) retained.resize(retention);
+
+    // Forget the models nobody holds any more, but not the loads in flight
+    for (auto it = detectors.begin(); it != detectors.end();) {
+        if (it->second.model.expired() && !it->second.loading.valid()) it = detectors.erase(it); else ++it;
+    }
+    for (auto it = landmarkModels.begin(); it != landmarkModels.end();) {
+        if (it->second.model.expired() && !it->second.loading.valid()) it = landmarkModels.erase(it); else ++it;
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __MODEL_REGISTRY
+#define __MODEL_REGISTRY
+
+#include <dlib/image_processing.h>
+#include <dlib/threads/thread_pool_extension.h>
+
+#include "face_detector.hpp"
+#include "compact_shape_predictor.hpp"
+
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** A landmark model as loaded from one file, pruned or not. predictor is
+ *  empty when the file is in the compact layout.
+ */
+struct LandmarkModel {
+    dlib::shape_predictor predictor;
+    CompactShapePredictor compact;
+    // Index in the 68 point model of each part, empty when they are the same
+    std::vector<unsigned long> landmarks;
+
+    unsigned long num_parts() const { return compact.empty() ? predictor.num_parts() : compact.num_parts(); }
+};
+
+/** The models loaded by the process, handed out read-only to every
+ *  HeadPoseEstimation that asks for the same file. A model is keyed by its
+ *  path and a hash of sampled content, so a file replaced in place is loaded
+ *  again.
+ *
+ *  Models load outside the registry lock, so that a slow load holds up
+ *  neither the other models nor setRetention(). Requests for a model being
+ *  loaded wait for that load rather than starting their own.
+ *
+ *  A model stays loaded while an estimator holds it. The most recently
+ *  requested ones also stay loaded after that, up to the retention, so that
+ *  an estimator created again after an app pause finds them in memory.
+ */
+class ModelRegistry {
+
+public:
+    static ModelRegistry& instance();
+
+    /** The face detector convert_face_detector or dlib's serialize() wrote to
+     *  path, dlib's embedded one when path is empty. Throws dlib::serialization_error when it cannot load.
+     */
+    std::shared_ptr<const FaceDetector> faceDetector(const std::string& path);
+
+    /** The landmark model at path, pruned as pruning says (PRUNE_NONE,
+     *  PRUNE_KEEP_ANCHORS or PRUNE_REANCHOR) unless it is in the compact
+     *  layout. Throws dlib::serialization_error when it cannot load.
+     */
+    std::shared_ptr<const LandmarkModel> landmarkModel(const std::string& path, int pruning);
+
+    /** One worker thread per core, shared by every estimator so that several
+     *  of them do not start more threads than there are cores. It stops with
+     *  the last estimator holding it.
+     */
+    std::shared_ptr<dlib::thread_pool> threadPool();
+
+    /** Number of recently requested models kept loaded when no estimator
+     *  holds them, 2 (a detector and a landmark model) by default. 0 frees
+     *  every model with its last estimator.
+     */
+    void setRetention(size_t models);
+
+private:
+    ModelRegistry();
+    ModelRegistry(const ModelRegistry&);
+    ModelRegistry& operator=(const ModelRegistry&);
+
+    // A model while some estimator holds it, or its load while in flight
+    template <typename Model>
+    struct Entry {
+        std::weak_ptr<const Model> model;
+        std::shared_future<std::shared_ptr<const Model> > loading;
+    };
+
+    /** The model at key in models, loaded by load() without the lock held
+     *  unless loaded or being loaded already. Rethrows what load() threw to
+     *  every request waiting for it.
+     */
+    template <typename Model, typename Load>
+    std::shared_ptr<const Model> acquire(std::map<std::string, Entry<Model> >& models, const std::string& key,
+                                         Load load);
+
+    // Called with mutex held
+    void retain(const std::shared_ptr<const void>& model);
+
+    std::mutex mutex;
+    std::map<std::string, Entry<FaceDetector> > detectors;
+    std::map<std::string, Entry<LandmarkModel> > landmarkModels;
+    std::weak_ptr<dlib::thread_pool> pool;
+    // Most recently requested first
+    std::list<std::shared_ptr<const void> > retained;
+    size_t retention;
+};
+
+#endif // __MODEL_REGISTRY
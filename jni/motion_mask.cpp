@@ -0,0 +1,43 @@
+#include "motion_mask.hpp"
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+
+MotionMask::MotionMask(int cell_size, int threshold, int refresh_interval) :
+    cell_size(cell_size), threshold(threshold), refresh_interval(refresh_interval),
+    frames_since_refresh(0) {
+}
+
+void MotionMask::configure(int thresh, int interval) {
+    threshold = thresh;
+    refresh_interval = interval;
+    frames_since_refresh = 0;
+}
+
+void MotionMask::reset() {
+    previous.release();
+    frames_since_refresh = 0;
+}
+
+void MotionMask::update(const cv::Mat& image, cv::Mat& changed) {
+    // Averaging the colour blocks first is cheaper than converting the full frame
+    cv::Mat small, gray;
+    cv::resize(image, small, cv::Size(std::max(1, image.cols / cell_size),
+                                      std::max(1, image.rows / cell_size)), 0, 0, cv::INTER_AREA);
+    cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+
+    changed.release();
+    const bool refresh = refresh_interval > 0 && frames_since_refresh >= refresh_interval;
+    if (!previous.empty() && previous.size() == gray.size() && !refresh) {
+        cv::absdiff(gray, previous, changed);
+        cv::threshold(changed, changed, threshold, 255, cv::THRESH_BINARY);
+        // Motion close to a block border shows up in the neighbour too
+        cv::dilate(changed, changed, cv::Mat());
+        frames_since_refresh++;
+    } else {
+        frames_since_refresh = 0;
+    }
+
+    previous = gray;
+}
@@ -0,0 +1,45 @@
+#ifndef __MOTION_MASK
+#define __MOTION_MASK
+
+#include <opencv2/core/core.hpp>
+
+/** Low resolution difference map between consecutive frames.
+ *
+ *  Frames are reduced to one grey level per cell_size x cell_size block; a
+ *  block changed when its mean moved by more than threshold since the
+ *  previous frame. Every refresh_interval frames the map is left empty so
+ *  that the caller rescans the whole frame and slow drifts below threshold
+ *  cannot pile up.
+ */
+class MotionMask {
+
+public:
+    MotionMask(int cell_size = 8, int threshold = 0, int refresh_interval = 30);
+
+    /** threshold 0 disables the mask, refresh_interval 0 never forces a full frame.
+     */
+    void configure(int threshold, int refresh_interval);
+
+    inline bool enabled() const { return threshold > 0; }
+
+    /** Forgets the previous frame, so that the next update() asks for the
+     *  whole frame. The settings stay.
+     */
+    void reset();
+
+    /** Compares image to the previous frame. changed gets one byte per block,
+     *  non zero where it changed, or is left empty when the whole frame must
+     *  be looked at: first frame, new frame size or periodic refresh.
+     */
+    void update(const cv::Mat& image, cv::Mat& changed);
+
+private:
+    int cell_size;
+    int threshold;
+    int refresh_interval;
+    int frames_since_refresh;
+
+    cv::Mat previous;
+};
+
+#endif // __MOTION_MASK
@@ -0,0 +1,33 @@
+#ifndef __PACKED_RESULTS
+#define __PACKED_RESULTS
+
+/** Layout of HeadPoseEstimation::packResults(), in 32 bit floats.
+ *
+ *  A header of PACKED_HEADER_SIZE floats, then PACKED_FACE_SIZE floats for
+ *  each face, in detection order. Offsets below are from the start of the
+ *  face's record.
+ */
+
+// Header: number of faces written, number of faces detected (more when the
+// buffer could not hold them all)
+const static int PACKED_FACES_WRITTEN = 0;
+const static int PACKED_FACES_DETECTED = 1;
+const static int PACKED_HEADER_SIZE = 2;
+
+// Stable id of the person, see HeadPoseEstimation::faceId()
+const static int PACKED_ID = 0;
+// Bounding box: left, top, width, height in pixels
+const static int PACKED_BOX = 1;
+// 68 x, y pairs in pixels, in the numbering of the 68 point model. Landmarks
+// a pruned model lacks are NaN; a 5 point model fills the first 5 pairs.
+const static int PACKED_LANDMARKS = 5;
+const static int PACKED_NUM_LANDMARKS = 68;
+// 4x4 head pose, row major, translation in meters
+const static int PACKED_POSE = PACKED_LANDMARKS + 2 * PACKED_NUM_LANDMARKS;
+// Yaw, pitch and roll in degrees
+const static int PACKED_ANGLES = PACKED_POSE + 16;
+// Camera position in the head frame, in meters
+const static int PACKED_CAMERA = PACKED_ANGLES + 3;
+const static int PACKED_FACE_SIZE = PACKED_CAMERA + 3;
+
+#endif // __PACKED_RESULTS
@@ -0,0 +1,98 @@
+#include "pose_renderer.hpp"
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace cv;
+
+static inline Point2f toCv(const dlib::point& p) {
+    return Point2f(p.x(), p.y());
+}
+
+/** Pinhole projection of a model point, as projectPoints without distortion.
+ */
+static inline Point2f projectPoint(const FacePose& pose, const Matx33f& camera, const Vec3d& point) {
+    const Vec3d p = pose.rotation * point + pose.tvec;
+    return Point2f(camera(0,0) * p[0] / p[2] + camera(0,2),
+                   camera(1,1) * p[1] / p[2] + camera(1,2));
+}
+
+PoseRenderer::PoseRenderer() :
+    enabled(true),
+    landmarkColor(0,255,0),
+    pointColor(0,255,255),
+    thickness(2) {
+}
+
+void PoseRenderer::drawLandmarks(Mat& image, const dlib::full_object_detection& d) const {
+    // The 5 point model: both eyes joined to the nose
+    if (d.num_parts() == 5) {
+        line(image, toCv(d.part(0)), toCv(d.part(1)), landmarkColor, thickness, LINE_AA);
+        line(image, toCv(d.part(1)), toCv(d.part(4)), landmarkColor, thickness, LINE_AA);
+        line(image, toCv(d.part(4)), toCv(d.part(3)), landmarkColor, thickness, LINE_AA);
+        line(image, toCv(d.part(3)), toCv(d.part(2)), landmarkColor, thickness, LINE_AA);
+        return;
+    }
+
+    // Pruned models only have some of the 68 landmarks, draw them as dots
+    if (d.num_parts() != 68) {
+        for (unsigned long i = 0; i < d.num_parts(); ++i)
+            circle(image, toCv(d.part(i)), 1, landmarkColor, thickness);
+        return;
+    }
+
+    // Draw lines for landmarks
+    for (unsigned long i = 1; i <= 16; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+
+    for (unsigned long i = 28; i <= 30; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+
+    for (unsigned long i = 18; i <= 21; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    for (unsigned long i = 23; i <= 26; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    for (unsigned long i = 31; i <= 35; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    line(image, toCv(d.part(30)), toCv(d.part(35)), landmarkColor, thickness, LINE_AA);
+
+    for (unsigned long i = 37; i <= 41; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    line(image, toCv(d.part(36)), toCv(d.part(41)), landmarkColor, thickness, LINE_AA);
+
+    for (unsigned long i = 43; i <= 47; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    line(image, toCv(d.part(42)), toCv(d.part(47)), landmarkColor, thickness, LINE_AA);
+
+    for (unsigned long i = 49; i <= 59; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    line(image, toCv(d.part(48)), toCv(d.part(59)), landmarkColor, thickness, LINE_AA);
+
+    for (unsigned long i = 61; i <= 67; ++i)
+        line(image, toCv(d.part(i)), toCv(d.part(i-1)), landmarkColor, thickness, LINE_AA);
+    line(image, toCv(d.part(60)), toCv(d.part(67)), landmarkColor, thickness, LINE_AA);
+}
+
+void PoseRenderer::drawPose(Mat& image, const FacePose& pose, int mode, const Matx33f& camera_matrix) const {
+    switch (mode) {
+    case MODE_ITERATIVE: drawModel(image, PoseModel<MODE_ITERATIVE>::points, pose, camera_matrix); break;
+    case MODE_P3P: drawModel(image, PoseModel<MODE_P3P>::points, pose, camera_matrix); break;
+    case MODE_EPNP: drawModel(image, PoseModel<MODE_EPNP>::points, pose, camera_matrix); break;
+    case MODE_GAUSS_NEWTON: drawModel(image, PoseModel<MODE_GAUSS_NEWTON>::points, pose, camera_matrix); break;
+    case MODE_FIVE_POINT: drawModel(image, PoseModel<MODE_FIVE_POINT>::points, pose, camera_matrix); break;
+    }
+
+    // Reproject the axes with the pose, and draw them onto the image
+    const Point2f origin = projectPoint(pose, camera_matrix, Vec3d(0,0,0));
+    line(image, origin, projectPoint(pose, camera_matrix, Vec3d(0,0,50)), Scalar(255,0,0), thickness, LINE_AA);
+    line(image, origin, projectPoint(pose, camera_matrix, Vec3d(0,50,0)), Scalar(0,255,0), thickness, LINE_AA);
+    line(image, origin, projectPoint(pose, camera_matrix, Vec3d(50,0,0)), Scalar(0,0,255), thickness, LINE_AA);
+}
+
+template <int N>
+void PoseRenderer::drawModel(Mat& image, const float (&points)[N][3], const FacePose& pose,
+                             const Matx33f& camera_matrix) const {
+    // Reproject the head points with the pose, and draw them onto the image
+    for (int i = 0; i < N; i++) {
+        const Vec3d point(points[i][0], points[i][1], points[i][2]);
+        circle(image, projectPoint(pose, camera_matrix, point), 2, pointColor, thickness);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __POSE_RENDERER
+#define __POSE_RENDERER
+
+#include <opencv2/core/core.hpp>
+#include <dlib/image_processing.h>
+
+#include "head_model.hpp"
+
+/** Draws landmarks and head poses onto an image. Kept apart from the pose
+ *  computation, so that poses can be computed concurrently and drawn only
+ *  when wanted.
+ */
+class PoseRenderer {
+
+public:
+    PoseRenderer();
+
+    /** Draws the contours joining the landmarks of a face, 68 or 5 of them,
+     *  or a dot per landmark for a pruned model.
+     */
+    void drawLandmarks(cv::Mat& image, const dlib::full_object_detection& shape) const;
+
+    /** Draws the model points of mode reprojected with the pose, and the head
+     *  axes, through the camera_matrix the pose was solved with.
+     */
+    void drawPose(cv::Mat& image, const FacePose& pose, int mode, const cv::Matx33f& camera_matrix) const;
+
+    // Off, the estimator neither copies the frame into resultMat nor draws
+    bool enabled;
+    cv::Scalar landmarkColor;
+    cv::Scalar pointColor;
+    int thickness;
+
+private:
+    template <int N>
+    void drawModel(cv::Mat& image, const float (&points)[N][3], const FacePose& pose,
+                   const cv::Matx33f& camera_matrix) const;
+};
+
+#endif // __POSE_RENDERER
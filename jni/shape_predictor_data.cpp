@@ -0,0 +1,35 @@
+#include "shape_predictor_data.hpp"
+
+#include <sstream>
+
+using namespace dlib;
+
+// Version written by the dlib shape_predictor serialization
+const static int SHAPE_PREDICTOR_VERSION = 1;
+
+void readShapePredictor(std::istream& in, ShapePredictorData& data) {
+    int version = 0;
+    dlib::deserialize(version, in);
+    if (version != SHAPE_PREDICTOR_VERSION)
+        throw serialization_error("Unexpected version found while deserializing dlib::shape_predictor.");
+    dlib::deserialize(data.initial_shape, in);
+    dlib::deserialize(data.forests, in);
+    dlib::deserialize(data.anchor_idx, in);
+    dlib::deserialize(data.deltas, in);
+}
+
+void writeShapePredictor(const ShapePredictorData& data, std::ostream& out) {
+    dlib::serialize(SHAPE_PREDICTOR_VERSION, out);
+    dlib::serialize(data.initial_shape, out);
+    dlib::serialize(data.forests, out);
+    dlib::serialize(data.anchor_idx, out);
+    dlib::serialize(data.deltas, out);
+}
+
+void toShapePredictor(const ShapePredictorData& data, shape_predictor& predictor) {
+    // shape_predictor has no public way to be built from its parts at this
+    // dlib version, go through its serialized form
+    std::stringstream buffer;
+    writeShapePredictor(data, buffer);
+    dlib::deserialize(predictor, buffer);
+}
@@ -0,0 +1,32 @@
+#ifndef __SHAPE_PREDICTOR_DATA
+#define __SHAPE_PREDICTOR_DATA
+
+#include <dlib/image_processing.h>
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/** The fields of a dlib::shape_predictor, in the order serialize() writes
+ *  them. shape_predictor keeps them private; this is how a model is read to
+ *  be pruned or converted, and written back.
+ */
+struct ShapePredictorData {
+    dlib::matrix<float,0,1> initial_shape;
+    std::vector<std::vector<dlib::impl::regression_tree> > forests;
+    std::vector<std::vector<unsigned long> > anchor_idx;
+    std::vector<std::vector<dlib::vector<float,2> > > deltas;
+};
+
+/** Reads what serialize(const shape_predictor&, std::ostream&) writes.
+ *  Throws dlib::serialization_error on anything else.
+ */
+void readShapePredictor(std::istream& in, ShapePredictorData& data);
+
+void writeShapePredictor(const ShapePredictorData& data, std::ostream& out);
+
+/** Builds a usable shape_predictor out of data.
+ */
+void toShapePredictor(const ShapePredictorData& data, dlib::shape_predictor& predictor);
+
+#endif // __SHAPE_PREDICTOR_DATA
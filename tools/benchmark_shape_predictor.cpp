@@ -0,0 +1,136 @@
+// Measures how far a compact shape predictor (pruned, quantized) drifts from
+// the dlib shape_predictor it was converted from, on a landmark test set in
+// dlib's XML format (e.g. labels_ibug_300W_test.xml of the iBUG 300-W set).
+//
+// Runs on the host, built against the same sources as the library:
+//   g++ -std=c++11 -O2 -DDLIB_NO_GUI_SUPPORT -DDLIB_JPEG_SUPPORT -DDLIB_PNG_SUPPORT \
+//       -Idlib -Ijni tools/benchmark_shape_predictor.cpp jni/compact_shape_predictor.cpp \
+//       jni/shape_predictor_data.cpp dlib/dlib/all/source.cpp \
+//       -ljpeg -lpng -lpthread -o benchmark_shape_predictor
+//
+// Usage: benchmark_shape_predictor <model.dat> <compact model> <dataset.xml>
+//   A dlib model in place of the compact one is laid out in memory, which
+//   checks the forest engine itself against dlib.
+//
+// Then runs the compact model with every shorter cascade depth, reporting the
+// error and time of each and how far it lands from the full depth.
+//
+// Errors are the mean landmark distance to the ground truth over the compact
+// model's landmarks, relative to the interocular distance (to the box width
+// when the ground truth is not the 68 point markup).
+
+#include "compact_shape_predictor.hpp"
+
+#include <dlib/data_io.h>
+#include <dlib/image_processing.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace dlib;
+
+static double normalizer(const full_object_detection& truth) {
+    if (truth.num_parts() != 68) return truth.get_rect().width();
+    dlib::vector<double,2> left, right;
+    for (unsigned long i = 36; i < 42; i++) left += truth.part(i);
+    for (unsigned long i = 42; i < 48; i++) right += truth.part(i);
+    return (left / 6 - right / 6).length();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <model.dat> <compact model> <dataset.xml>" << std::endl;
+        return 1;
+    }
+
+    try {
+        shape_predictor reference;
+        deserialize(argv[1]) >> reference;
+        CompactShapePredictor compact;
+        if (CompactShapePredictor::isCompact(argv[2])) {
+            compact.load(argv[2]);
+        } else {
+            std::ifstream in(argv[2], std::ios::binary);
+            if (!in) throw serialization_error(std::string("Unable to open ") + argv[2]);
+            ShapePredictorData data;
+            readShapePredictor(in, data);
+            compact.assign(data, std::vector<unsigned long>());
+        }
+
+        dlib::array<array2d<unsigned char> > images;
+        std::vector<std::vector<full_object_detection> > truths;
+        load_image_dataset(images, truths, argv[3]);
+
+        double reference_error = 0, compact_error = 0, drift = 0, max_drift = 0;
+        double reference_time = 0, compact_time = 0;
+        unsigned long faces = 0;
+        for (unsigned long i = 0; i < images.size(); i++) {
+            for (const full_object_detection& truth : truths[i]) {
+                typedef std::chrono::steady_clock clock;
+                const clock::time_point t0 = clock::now();
+                const full_object_detection expected = reference(images[i], truth.get_rect());
+                const clock::time_point t1 = clock::now();
+                const full_object_detection got = compact(images[i], truth.get_rect());
+                const clock::time_point t2 = clock::now();
+                reference_time += std::chrono::duration<double, std::milli>(t1 - t0).count();
+                compact_time += std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+                const double scale = normalizer(truth);
+                double face_reference = 0, face_compact = 0;
+                for (unsigned long p = 0; p < got.num_parts(); p++) {
+                    const unsigned long landmark = compact.landmark(p);
+                    face_reference += (expected.part(landmark) - truth.part(landmark)).length();
+                    face_compact += (got.part(p) - truth.part(landmark)).length();
+                    const double d = (got.part(p) - expected.part(landmark)).length();
+                    drift += d;
+                    max_drift = std::max(max_drift, d);
+                }
+                reference_error += face_reference / got.num_parts() / scale;
+                compact_error += face_compact / got.num_parts() / scale;
+                faces++;
+            }
+        }
+        if (faces == 0) throw error("No faces in the dataset.");
+
+        std::cout << faces << " faces, " << compact.num_parts() << " landmarks, "
+                  << compact.leaf_bits() << " bit leaves" << std::endl
+                  << "reference error: " << reference_error / faces
+                  << ", " << reference_time / faces << " ms per face" << std::endl
+                  << "compact error:   " << compact_error / faces
+                  << ", " << compact_time / faces << " ms per face" << std::endl
+                  << "drift from the reference: mean " << drift / (faces * compact.num_parts())
+                  << " px, max " << max_drift << " px" << std::endl;
+
+        // Cost and accuracy of stopping the cascade early
+        std::cout << std::endl << "levels  error      drift from full depth (px)  ms per face" << std::endl;
+        for (unsigned long levels = 1; levels <= compact.num_levels(); levels++) {
+            double depth_error = 0, depth_drift = 0, depth_time = 0;
+            for (unsigned long i = 0; i < images.size(); i++) {
+                for (const full_object_detection& truth : truths[i]) {
+                    typedef std::chrono::steady_clock clock;
+                    const clock::time_point t0 = clock::now();
+                    const full_object_detection got = compact(images[i], truth.get_rect(), levels);
+                    const clock::time_point t1 = clock::now();
+                    depth_time += std::chrono::duration<double, std::milli>(t1 - t0).count();
+                    const full_object_detection full = compact(images[i], truth.get_rect());
+
+                    double face_error = 0;
+                    for (unsigned long p = 0; p < got.num_parts(); p++) {
+                        face_error += (got.part(p) - truth.part(compact.landmark(p))).length();
+                        depth_drift += (got.part(p) - full.part(p)).length();
+                    }
+                    depth_error += face_error / got.num_parts() / normalizer(truth);
+                }
+            }
+            std::cout << std::setw(6) << levels << "  " << std::setw(9) << depth_error / faces
+                      << "  " << std::setw(26) << depth_drift / (faces * compact.num_parts())
+                      << "  " << std::setw(11) << depth_time / faces << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
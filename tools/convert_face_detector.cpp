@@ -0,0 +1,42 @@
+// Writes dlib's frontal face detector to a file with its HOG filters already
+// built, so that the library reads it at startup instead of decoding the copy
+// embedded in dlib and building the filters from its weights.
+//
+// Runs on the host, built against the same sources as the library:
+//   g++ -std=c++11 -O2 -DDLIB_NO_GUI_SUPPORT -Idlib -Ijni tools/convert_face_detector.cpp \
+//       jni/face_detector.cpp dlib/dlib/all/source.cpp \
+//       $(pkg-config --cflags --libs opencv) -lpthread -o convert_face_detector
+//
+// Usage: convert_face_detector <output> [detector.dat]
+//   detector.dat: a frontal_face_detector dlib's serialize() wrote, dlib's
+//   embedded one when omitted
+
+#include "face_detector.hpp"
+
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <output> [detector.dat]" << std::endl;
+        return 1;
+    }
+
+    try {
+        dlib::frontal_face_detector detector;
+        if (argc > 2) dlib::deserialize(argv[2]) >> detector;
+        else detector = dlib::get_frontal_face_detector();
+
+        std::ofstream out(argv[1], std::ios::binary);
+        FaceDetector(detector).serialize(out);
+        out.close();
+        if (!out) throw dlib::serialization_error(std::string("Unable to write ") + argv[1]);
+
+        std::cout << "Face detector with " << detector.num_detectors() << " filters written to "
+                  << argv[1] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
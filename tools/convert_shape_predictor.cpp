@@ -0,0 +1,55 @@
+// Converts a dlib shape_predictor (e.g. shape_predictor_68_face_landmarks.dat)
+// into the memory mapped layout of CompactShapePredictor, optionally pruned to
+// the landmarks the pose modes read, and quantized.
+//
+// Runs on the host, built against the same sources as the library:
+//   g++ -std=c++11 -O2 -DDLIB_NO_GUI_SUPPORT -Idlib -Ijni -Ithird_party/miniglog \
+//       tools/convert_shape_predictor.cpp jni/shape_predictor_data.cpp \
+//       jni/compact_shape_predictor.cpp jni/landmark_pruning.cpp jni/head_model.cpp \
+//       third_party/miniglog/glog/logging.cc dlib/dlib/all/source.cpp \
+//       -lpthread -o convert_shape_predictor
+//
+// Usage: convert_shape_predictor <model.dat> <output> [pruning] [leaf_bits]
+//   pruning: 0 keeps every landmark (PRUNE_NONE), 1 PRUNE_KEEP_ANCHORS, 2 PRUNE_REANCHOR
+//   leaf_bits: 32 float leaves (default), 16 or 8 quantized; measure the accuracy
+//   they cost with benchmark_shape_predictor
+
+#include "compact_shape_predictor.hpp"
+#include "landmark_pruning.hpp"
+#include "head_model.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <model.dat> <output> [pruning] [leaf_bits]" << std::endl;
+        return 1;
+    }
+    const int pruning = argc > 3 ? std::atoi(argv[3]) : PRUNE_NONE;
+    const int leaf_bits = argc > 4 ? std::atoi(argv[4]) : 32;
+
+    try {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in) throw dlib::serialization_error(std::string("Unable to open ") + argv[1]);
+        ShapePredictorData data;
+        readShapePredictor(in, data);
+
+        std::vector<unsigned long> kept;
+        if (pruning != PRUNE_NONE) pruneLandmarks(data, poseLandmarks(), pruning, kept);
+
+        std::ofstream out(argv[2], std::ios::binary);
+        writeCompactShapePredictor(data, kept, out, leaf_bits);
+        out.close();
+        if (!out) throw dlib::serialization_error(std::string("Unable to write ") + argv[2]);
+
+        std::cout << argv[1] << ": " << data.initial_shape.size() / 2 << " landmarks, "
+                  << data.forests.size() << " cascade levels, " << leaf_bits << " bit leaves, written to "
+                  << argv[2] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}